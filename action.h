@@ -1,54 +1,47 @@
 #pragma once
 #include <algorithm>
-#include <unordered_map>
+#include <type_traits>
 #include <string>
 #include "board.h"
 
+/**
+ * compact action encoding (32-bit, trivially copyable)
+ *
+ * bits 24-31: type, 's' for slide or 'p' for place
+ * slide: bits 0-1 are the opcode (URDL)
+ * place: bits 0-3 are the position, bits 4-9 are the tile, bits 10-15 are the next hint
+ *
+ * the text encoding is "#U", "#R", "#D", "#L" for slides,
+ * and "0C" (position 0, tile C) for places, optionally followed by "+hint"
+ */
 class action {
 public:
-    action(unsigned code = -1u, unsigned h = 0) : code(code), hint(h) {}
-    action(const action& a) : code(a.code), hint(a.hint) {}
-    virtual ~action() {}
+    action(unsigned code = -1u) : code(code) {}
 
     class slide; // create a sliding action with board opcode
     class place; // create a placing action with position and tile
 
 public:
-    virtual board::reward apply(board& b) const {
-        auto proto = entries().find(type());
-        if (proto != entries().end()) return proto->second->reinterpret(this).apply(b);
-        return -1;
-    }
-    virtual std::ostream& operator >>(std::ostream& out) const {
-        auto proto = entries().find(type());
-        if (proto != entries().end()) return proto->second->reinterpret(this) >> out;
-        return out << "??";
-    }
-    virtual std::istream& operator <<(std::istream& in) {
-        auto state = in.rdstate();
-        for (auto proto = entries().begin(); proto != entries().end(); proto++) {
-            if (proto->second->reinterpret(this) << in) return in;
-            in.clear(state);
-        }
-        return in.ignore(2);
-    }
+    board::reward apply(board& b) const;
+    static action parse(const char* s, size_t n);
 
 public:
     operator unsigned() const { return code; }
     unsigned type() const { return code & type_flag(-1u); }
     unsigned event() const { return code & ~type(); }
-    friend std::ostream& operator <<(std::ostream& out, const action& a) { return a >> out; }
-    friend std::istream& operator >>(std::istream& in, action& a) { return a << in; }
+    friend std::ostream& operator <<(std::ostream& out, const action& a);
+    friend std::istream& operator >>(std::istream& in, action& a);
+
+    /**
+     * the characters of positions, tiles, and hints in the text form
+     */
+    static const char* index() { return "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ?"; }
 
 protected:
     static constexpr unsigned type_flag(unsigned v) { return v << 24; }
-
-    typedef std::unordered_map<unsigned, action*> prototype;
-    static prototype& entries() { static prototype m; return m; }
-    virtual action& reinterpret(const action* a) const { return *new (const_cast<action*>(a)) action(*a); }
+    static const char* opcode() { return "URDL"; }
 
     unsigned code;
-    unsigned hint;
 };
 
 class action::slide : public action {
@@ -56,63 +49,71 @@ public:
     static constexpr unsigned type = type_flag('s');
     slide(unsigned oper) : action(slide::type | (oper & 0b11)) {}
     slide(const action& a = {}) : action(a) {}
-public:
-    board::reward apply(board& b) const {
-        return b.slide(event());
-    }
-    std::ostream& operator >>(std::ostream& out) const {
-        return out << '#' << ("URDL")[event() & 0b11];
-    }
-    std::istream& operator <<(std::istream& in) {
-        if (in.peek() == '#') {
-            char v;
-            in.ignore(1) >> v;
-            const char* opc = "URDL";
-            unsigned oper = std::find(opc, opc + 4, v) - opc;
-            if (oper < 4) {
-                operator= (action::slide(oper));
-                return in;
-            }
-        }
-        in.setstate(std::ios::failbit);
-        return in;
-    }
-protected:
-    action& reinterpret(const action* a) const { return *new (const_cast<action*>(a)) slide(*a); }
-    static __attribute__((constructor)) void init() { entries()[type_flag('s')] = new slide; }
+    unsigned oper() const { return event() & 0b11; }
 };
 
 class action::place : public action {
 public:
     static constexpr unsigned type = type_flag('p');
-    place(unsigned pos, unsigned tile, unsigned hint) : action(place::type | (pos & 0x0f) | (std::min(tile, 35u) << 4), hint) {}
+    place(unsigned pos, unsigned tile, unsigned hint) : action(place::type | (pos & 0x0f) | (std::min(tile, 35u) << 4) | (std::min(hint, 35u) << 10)) {}
     place(const action& a = {}) : action(a) {}
     unsigned position() const { return event() & 0x0f; }
-    unsigned tile() const { return event() >> 4; }
-public:
-    board::reward apply(board& b) const {
-        return b.place(position(), tile(), hint);
+    unsigned tile() const { return (event() >> 4) & 0x3f; }
+    unsigned hint() const { return (event() >> 10) & 0x3f; }
+};
+
+static_assert(sizeof(action) == sizeof(uint32_t), "action should be a 32-bit value");
+static_assert(std::is_trivially_copyable<action>::value, "action should be trivially copyable");
+
+inline board::reward action::apply(board& b) const {
+    switch (type()) {
+    case slide::type: return b.slide(slide(*this).oper());
+    case place::type: return b.place(place(*this).position(), place(*this).tile(), place(*this).hint());
+    default:          return -1;
+    }
+}
+
+/**
+ * parse an action from a character sequence without allocation
+ * e.g. "#U" for sliding up, "0C" for placing tile C at position 0,
+ * or "0C+2" for placing tile C at position 0 with the next hint 2
+ * return an invalid action if the sequence is malformed
+ */
+inline action action::parse(const char* s, size_t n) {
+    const char* idx = index();
+    if (n == 2 && s[0] == '#') {
+        unsigned oper = std::find(opcode(), opcode() + 4, s[1]) - opcode();
+        if (oper < 4) return action::slide(oper);
+    } else if (n == 2 || (n == 4 && s[2] == '+')) {
+        unsigned pos = std::find(idx, idx + 16, s[0]) - idx;
+        unsigned tile = std::find(idx, idx + 36, s[1]) - idx;
+        unsigned hint = n == 4 ? std::find(idx, idx + 36, s[3]) - idx : 0;
+        if (pos < 16 && tile < 36 && hint < 36) return action::place(pos, tile, hint);
     }
-    std::ostream& operator >>(std::ostream& out) const {
-        const char* idx = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ?";
-        return out << idx[position()] << idx[std::min(tile(), 36u)];
+    return action();
+}
+
+inline std::ostream& operator <<(std::ostream& out, const action& a) {
+    switch (a.type()) {
+    case action::slide::type:
+        return out << '#' << action::opcode()[action::slide(a).oper()];
+    case action::place::type:
+        return out << action::index()[action::place(a).position()] << action::index()[std::min(action::place(a).tile(), 36u)];
+    default:
+        return out << "??";
     }
-    std::istream& operator <<(std::istream& in) {
-        const char* idx = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
-        char v = in.peek();
-        unsigned pos = std::find(idx, idx + 16, v) - idx;
-        if (pos < 16) {
-            in.ignore(1) >> v;
-            unsigned tile = std::find(idx, idx + 36, v) - idx;
-            if (tile < 36) {
-                operator =(action::place(pos, tile, hint));
-                return in;
-            }
+}
+
+inline std::istream& operator >>(std::istream& in, action& a) {
+    auto state = in.rdstate();
+    char s[2];
+    if (in.get(s[0]) && in.get(s[1])) {
+        action res = action::parse(s, 2);
+        if (res.type() == action::slide::type || res.type() == action::place::type) {
+            a = res;
+            return in;
         }
-        in.setstate(std::ios::failbit);
-        return in;
     }
-protected:
-    action& reinterpret(const action* a) const { return *new (const_cast<action*>(a)) place(*a); }
-    static __attribute__((constructor)) void init() { entries()[type_flag('p')] = new place; }
-};
+    in.clear(state);
+    return in;
+}
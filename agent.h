@@ -6,9 +6,22 @@
 #include <type_traits>
 #include <algorithm>
 #include <fstream>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <tuple>
+#include <exception>
+#include <chrono>
 #include "board.h"
 #include "action.h"
 #include "weight.h"
+#include "remote.h"
+#include "checkpoint.h"
+#include "successor.h"
+#include "profile.h"
+#include "cache.h"
+#include "telemetry.h"
+#include "heatmap.h"
 
 #define BIG_FLOAT 99999999.0;
 #define SMALL_FLOAT -99999999.0;
@@ -35,6 +48,18 @@ public:
     virtual action take_action(const board& b) { return action(); }
     virtual bool check_for_win(const board& b) { return false; }
 
+    /**
+     * think ahead while the opponent is to move at the given state, e.g., in the background of the shell,
+     * so that the later take_action may be answered at once; should return soon after 'stop' is set
+     */
+    virtual void ponder(const board& state, const std::atomic<bool>& stop) {}
+
+    /**
+     * the agent is replaced (e.g., reloaded) but may still finish its ongoing games,
+     * after which it should leave no trace such as its saved weights
+     */
+    virtual void retire() {}
+
 public:
     virtual std::string property(const std::string& key) const { return meta.at(key); }
     virtual void notify(const std::string& msg) { meta[msg.substr(0, msg.find('='))] = { msg.substr(msg.find('=') + 1) }; }
@@ -76,90 +101,359 @@ protected:
  */
 class weight_agent : public agent {
 public:
-    weight_agent(const std::string& args = "") : agent(args), learning_rate(0.1 / TUPLE_NUM) {
+    typedef std::vector<weight> network;
+
+public:
+    weight_agent(const std::string& args = "") : agent(args), learning_rate(0.1 / TUPLE_NUM), net(std::make_shared<network>()), shared(false), failed(false), depth(EXPECT_SEARCH_LEVEL), nodes(0), cancel(nullptr), interval(0), episodes(0) {
+        if (meta.find("compact") != meta.end()) // pass compact=... to set the number of deltas before a full save
+            store.set_compact(size_t(meta["compact"]));
+        if (meta.find("delta") != meta.end()) // pass delta=1 to save only the changed pages when saving to the loaded file
+            store.set_delta(int(meta["delta"]));
+        if (meta.find("compress") != meta.end()) // pass compress=... to save compressed, keeping ... bits of each weight (32 is lossless)
+            store.set_precision(unsigned(meta["compress"]));
         if (meta.find("init") != meta.end()) // pass init=... to initialize the weight
             init_weights(meta["init"]);
         if (meta.find("load") != meta.end()) // pass load=... to load from a specific file
             load_weights(meta["load"]);
         if (meta.find("learning_rate") != meta.end())
             learning_rate = float(meta["learning_rate"]);
+        if (meta.find("seed") != meta.end()) // pass seed=... to seed the random engine
+            random_engine.seed(int(meta["seed"]));
+        if (meta.find("depth") != meta.end()) // pass depth=... to set the search depth
+            depth = int(meta["depth"]);
+        if (meta.find("remote") != meta.end()) // pass remote=... to train with a parameter server, also sync=... and slice=...
+            open_remote(meta["remote"], meta.find("sync") != meta.end() ? size_t(meta["sync"]) : 1,
+                meta.find("slice") != meta.end() ? size_t(meta["slice"]) : 65536);
+        if (meta.find("checkpoint") != meta.end()) // pass checkpoint=... to save incrementally every ... episodes
+            interval = size_t(meta["checkpoint"]);
+        if (meta.find("cache") != meta.end()) // pass cache=... to keep the search values in a file, also cache_size=... (MB)
+            open_cache(meta["cache"], meta.find("cache_size") != meta.end() ? size_t(meta["cache_size"]) : 256);
+        if (meta.find("heatmap") != meta.end()) // pass heatmap=... to report the sampled accesses to a file, also heatmap_sample=... (1/64 by default)
+            heat = std::make_shared<access_heatmap>(*net, meta.find("heatmap_sample") != meta.end() ? unsigned(meta["heatmap_sample"]) : 64);
+    }
+    /**
+     * create an agent which shares the weight tables of another agent, e.g., for worker threads
+     * the shared agent never saves the weights, and args can override the properties such as seed=...
+     */
+    weight_agent(const weight_agent& share, const std::string& args) : agent(share), learning_rate(share.learning_rate), net(share.net), shared(share.shared), failed(share.failed), cache(share.cache), heat(share.heat), depth(share.depth), nodes(0), cancel(nullptr), interval(0), episodes(0) {
+        meta.erase("save");
+        meta.erase("heatmap");
+        std::stringstream ss(args);
+        for (std::string pair; ss >> pair; notify(pair));
+        if (meta.find("seed") != meta.end())
+            random_engine.seed(int(meta["seed"]));
+        if (meta.find("depth") != meta.end())
+            depth = int(meta["depth"]);
     }
     virtual ~weight_agent() {
+        if (remote) close_remote();
         if (meta.find("save") != meta.end()) // pass save=... to save to a specific file
             save_weights(meta["save"]);
+        if (meta.find("heatmap") != meta.end() && heat)
+            report_heatmap(meta["heatmap"]);
+    }
+
+public:
+    network& weights() { return writable(); }
+
+    virtual void retire() {
+        meta.erase("save");
+        meta.erase("heatmap");
+    }
+
+    /**
+     * reseed the random engine, e.g., for each game of a fixed suite
+     */
+    void seed(unsigned s) { random_engine.seed(s); }
+
+    /**
+     * the number of search nodes (max and chance nodes) expanded so far
+     */
+    size_t node_count() const { return nodes; }
+
+    /**
+     * a private copy of the current weight tables, e.g., to be published to the actors
+     */
+    std::shared_ptr<network> snapshot() const { return std::make_shared<network>(*net); }
+
+    /**
+     * switch to other weight tables, e.g., a snapshot published by the learner
+     * the cache is detached since its values belong to the previous weights
+     */
+    void share_weights(const std::shared_ptr<network>& tables) {
+        store.wait();
+        net = tables;
+        shared = true;
+        cache.reset();
+    }
+
+    /**
+     * the number of materialized pages and the number of all pages of the weight tables
+     */
+    std::pair<size_t, size_t> page_count() const {
+        size_t used = 0, total = 0;
+        for (const weight& w : *net) used += w.materialized(), total += w.pages();
+        return { used, total };
+    }
+
+    /**
+     * whether loading the weights has failed, which only returns for a reload (see load_weights)
+     */
+    bool load_failed() const { return failed; }
+
+    /**
+     * the occupancy of the sparse weight tables, e.g., "1234/356000 pages (0.35%, 4MB)"
+     */
+    std::string occupancy() const {
+        size_t used = page_count().first, total = page_count().second;
+        std::stringstream ss;
+        ss << used << "/" << total << " pages (" << (total ? used * 100.0 / total : 0) << "%, ";
+        ss << ((used * weight::page_size * sizeof(float)) >> 20) << "MB)";
+        if (cache)
+            ss << ", cache " << cache->hit_count() << "/" << (cache->hit_count() + cache->miss_count()) << " hits";
+        return ss.str();
     }
 
 protected:
     virtual void init_weights(const std::string& info) {
         int possibility = (int)std::pow(MAX_TILE_INDEX, TUPLE_LEN);
         for (int i = 0; i < TUPLE_NUM; i++)
-            net.emplace_back(possibility);
+            net->emplace_back(possibility);
     }
 
+    /**
+     * load the base file and its incremental deltas (path.1, path.2, ...)
+     * the tables are shared with the other agents which have loaded the same files, until the first write
+     */
     virtual void load_weights(const std::string& path) {
-        std::ifstream in(path, std::ios::in | std::ios::binary);
-        if (!in.is_open()) std::exit(-1);
-        uint32_t size;
-        in.read(reinterpret_cast<char*>(&size), sizeof(size));
-        net.resize(size);
-        for (weight& w : net) in >> w;
-        in.close();
+        profiler::scope prof(profiler::io);
+        std::string id = checkpoint::identity(path);
+        std::lock_guard<std::mutex> guard(registry().lock);
+        auto it = registry().loaded.find(id);
+        if (it != registry().loaded.end()) {
+            std::shared_ptr<network> tables = it->second.first.lock();
+            if (tables) {
+                net = tables;
+                shared = true;
+                store.adopt(path, it->second.second);
+                return;
+            }
+        }
+        bool ok;
+        try {
+            ok = store.load(path, *net);
+        } catch (std::exception&) { // e.g., bad_alloc for a corrupted file
+            ok = false;
+        }
+        if (!ok) {
+            if (meta.find("reload") == meta.end()) std::exit(-1);
+            net->clear(); // a reload keeps the previous agent instead, see reloader
+            failed = true;
+            return;
+        }
+        registry().loaded[id] = { net, store.deltas() };
+        shared = true;
     }
 
+    /**
+     * the weight tables to be modified, which are taken out of the registry first,
+     * and are copied if other agents are still sharing them
+     */
+    network& writable() {
+        if (shared) {
+            store.wait();
+            std::lock_guard<std::mutex> guard(registry().lock);
+            for (auto it = registry().loaded.begin(); it != registry().loaded.end(); ) {
+                if (it->second.first.lock() == net) it = registry().loaded.erase(it);
+                else it++;
+            }
+            if (net.use_count() > 1) net = std::make_shared<network>(*net);
+            shared = false;
+        }
+        return *net;
+    }
+
+    /**
+     * save only the changed pages as a delta if delta=1 and path is where the weights came from,
+     * otherwise (or after compact=... deltas) save the full weights
+     */
     virtual void save_weights(const std::string& path) {
-        std::ofstream out(path, std::ios::out | std::ios::binary | std::ios::trunc);
+        profiler::scope prof(profiler::io);
+        auto start = std::chrono::steady_clock::now();
+        if (!store.save(path, *net)) std::exit(-1);
+        telemetry::record_checkpoint(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+
+    /**
+     * take an incremental checkpoint every 'checkpoint' episodes by a copy-on-write snapshot
+     */
+    virtual void checkpoint_weights() {
+        if (interval && ++episodes % interval == 0 && meta.find("save") != meta.end()) {
+            auto start = std::chrono::steady_clock::now();
+            store.save(meta["save"], *net, true);
+            telemetry::record_checkpoint(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        }
+    }
+
+    /**
+     * write the report of the sampled accesses to the weight tables
+     */
+    virtual void report_heatmap(const std::string& path) {
+        std::ofstream out(path, std::ios::out | std::ios::trunc);
         if (!out.is_open()) std::exit(-1);
-        uint32_t size = net.size();
-        out.write(reinterpret_cast<char*>(&size), sizeof(size));
-        for (weight& w : net) out << w;
-        out.close();
+        out << name() << " ";
+        heat->report(out, *net);
+    }
+
+    /**
+     * open the persistent search cache, keyed by the hash of the current weights
+     */
+    virtual void open_cache(const std::string& path, size_t mbytes) {
+        profiler::scope prof(profiler::io);
+        cache = std::make_shared<eval_cache>(path, mbytes, eval_cache::hash(*net));
+        if (!cache->is_open()) std::exit(-1);
+    }
+
+    /**
+     * connect to the parameter server, which must be running
+     */
+    virtual void open_remote(const std::string& path, size_t sync, size_t slice) {
+        try {
+            remote = std::make_shared<param_client>(path, sync, slice);
+        } catch (std::runtime_error& e) {
+            std::cerr << e.what() << std::endl;
+            std::exit(-1);
+        }
+    }
+
+    /**
+     * push the deltas of the episodes since the last sync, so that none of the training is lost
+     */
+    virtual void close_remote() {
+        try {
+            if (remote->pending()) remote->flush(writable());
+        } catch (std::runtime_error& e) {
+            std::cerr << e.what() << std::endl;
+        }
+        remote.reset();
+    }
+
+    /**
+     * the only way to modify a single weight entry during training
+     * the cached values no longer match the weights, so the cache is detached (the file keeps its entries)
+     */
+    void update(int table, int index, float delta) {
+        writable()[table][index] += delta;
+        if (heat && heat->sample()) heat->write(table, index);
+        if (remote) remote->record(table, index, delta);
+        if (cache) cache.reset();
+    }
+
+    /**
+     * the actions found by pondering, keyed by the whole state including the next tile and the bag
+     */
+    struct state_order {
+        bool operator ()(const board& a, const board& b) const {
+            if (a != b) return a < b;
+            return std::make_tuple(a.get_next_tile(), a.get_last_op(), a.get_tile_counter(), a.get_max_tile(),
+                                   a.get_bag_count(1), a.get_bag_count(2), a.get_bag_count(3))
+                 < std::make_tuple(b.get_next_tile(), b.get_last_op(), b.get_tile_counter(), b.get_max_tile(),
+                                   b.get_bag_count(1), b.get_bag_count(2), b.get_bag_count(3));
+        }
+    };
+    typedef std::map<board, action, state_order> ponder_table;
+
+    /**
+     * the pondered action of a state, or an invalid action if it has not been pondered
+     */
+    action pondered(const board& state) {
+        auto it = pondering.find(state);
+        if (it == pondering.end()) return action();
+        action a = it->second;
+        pondering.erase(it);
+        return a;
+    }
+
+    /**
+     * search the replies to the given states in order, until all are done or 'stop' is raised
+     * the states are the possible results of the opponent's move, the replies are kept for take_action
+     */
+    template<typename search_t>
+    void ponder_states(const std::vector<board>& states, const std::atomic<bool>& stop, search_t search) {
+        if (pondering.size() > 65536) pondering.clear();
+        cancel = &stop;
+        for (const board& state : states) {
+            if (stop) break;
+            if (pondering.find(state) != pondering.end()) continue;
+            action a = search(state);
+            if (!stop) pondering[state] = a;
+        }
+        cancel = nullptr;
     }
 
+    /**
+     * the per-tuple values of the last leaf evaluated for each slide under a chance node,
+     * from which the values of the next leaves of the same slide are derived
+     */
+    struct reference {
+        board::grid state;
+        std::array<int, TUPLE_NUM> key;
+        std::array<float, TUPLE_NUM> value;
+        bool valid;
+    };
+    typedef std::array<reference, 4> references;
+
     virtual float get_after_state(const board& after, const int& level) {
-        if (level >= EXPECT_SEARCH_LEVEL)
+        if (level >= depth)
             return get_board_value(after);
+        if (cancel && cancel->load(std::memory_order_relaxed))
+            return 0; // the result is discarded
 
+        nodes++;
+        uint64_t key = 0;
         float expect_value = 0.0;
-        int expect_counter = 0;
-        board b = board(after);
-        std::vector<board::cell> next_bag;
-        board::cell hint_flag = 0;
-
-        b.remove_tile(b.get_next_tile());
-        next_bag = b.get_bag();
-
-        if (b.get_tile_counter() >= 20 && b.get_max_tile() >= 7) {
-            random_generator.param(std::uniform_int_distribution<>::param_type {4, (int)b.get_max_tile() - 3});
-            next_bag.emplace_back(random_generator(random_engine));
-        }
-
-        for (auto& pos : side_space[after.get_last_op()]) {
-            hint_flag = 0;
-            for (auto& next_hint : next_bag) {
-                if (next_hint <= hint_flag)
-                    continue;
-                else
-                    hint_flag = next_hint;
-                     
-                b = board(after);
-                board::reward reward = b.place(pos, b.get_next_tile(), next_hint);
-                if (reward == -1) continue;
-                expect_value += reward + get_before_state(b, level);
-                expect_counter++;
+        if (cache) {
+            key = cache->key(after, level, depth);
+            if (cache->find(key, expect_value)) return expect_value;
+        }
+
+        // the hint does not matter if the next after-states are leaves,
+        // which are then evaluated incrementally from their siblings
+        bool merge_hints = level + 1 >= depth;
+        references refs;
+        for (reference& ref : refs) ref.valid = false;
+        for (const successor::outcome& next : successor(after, side_space[after.get_last_op()], merge_hints)) {
+            board b = after;
+            board::reward reward;
+            {
+                profiler::scope prof(profiler::board_op);
+                reward = next.apply(b);
             }
+            expect_value += next.prob * (reward + get_before_state(b, level, merge_hints ? &refs : nullptr));
         }
-        return expect_counter != 0 ? expect_value / expect_counter : 0.0;
+        if (cancel && cancel->load(std::memory_order_relaxed))
+            return 0; // some successors were aborted, so the sum is partial and must not be cached
+        if (cache) cache->insert(key, expect_value);
+        return expect_value;
     }
 
-    virtual float get_before_state(const board& before, const int& level) {
+    /**
+     * the leaves (at level + 1 >= depth) are evaluated from the references of their slides if given
+     */
+    virtual float get_before_state(const board& before, const int& level, references* refs = nullptr) {
+        nodes++;
         float best_expect = SMALL_FLOAT;
         bool move_flag = false;
 
         for (auto& op : all_op) {
             board b = board(before);
-            board::reward reward = b.slide(op);
+            board::reward reward;
+            {
+                profiler::scope prof(profiler::board_op);
+                reward = b.slide(op);
+            }
             if (reward == -1) continue;
-            float value = reward + get_after_state(b, level + 1);
+            float value = reward + (refs && level + 1 >= depth ? get_board_value(b, (*refs)[op]) : get_after_state(b, level + 1));
             if (value > best_expect) {
                 best_expect = value;
                 move_flag = true;
@@ -172,12 +466,211 @@ protected:
     }
 
     virtual float get_board_value(const board& b) {
-        float weight_sum = net[0][get_feature_key(b, 0)];
+        std::array<int, TUPLE_NUM> keys;
+        {
+            profiler::scope prof(profiler::feature);
+            for (int i = 0; i < TUPLE_NUM; i++)
+                keys[i] = get_feature_key(b, i);
+        }
+        if (heat && heat->sample()) {
+            for (int i = 0; i < TUPLE_NUM; i++) heat->read(i, keys[i]);
+        }
+        profiler::scope prof(profiler::lookup);
+        const network& net = *this->net;
+        float weight_sum = net[0][keys[0]];
+        for (int i = 1; i < TUPLE_NUM; i++)
+            weight_sum += net[i][keys[i]];
+        return weight_sum;
+    }
+
+    /**
+     * the value of a board derived from a reference board, where only the tuples covering the cells
+     * which differ from the reference are updated, by adjusting their keys with the coefficients of
+     * the cells and looking them up again; then the board becomes the reference
+     * the leaves of the same slide under a chance node mostly differ only around the line of the placed tile,
+     * and the sum is exactly that of get_board_value
+     */
+    float get_board_value(const board& b, reference& ref) {
+        uint32_t changed = ref.valid ? 0 : -1u; // the tuples covering the changed cells
+        {
+            profiler::scope prof(profiler::feature);
+            if (!ref.valid) {
+                for (int i = 0; i < TUPLE_NUM; i++)
+                    ref.key[i] = get_feature_key(b, i);
+            }
+            for (int pos = 0; pos < 16 && ref.valid; pos++) {
+                int delta = int(b(pos)) - int(ref.state[pos / 4][pos % 4]);
+                if (delta == 0) continue;
+                const cell_terms_t& cell = cell_terms[pos];
+                for (int t = 0; t < cell.num; t++)
+                    ref.key[cell.term[t].first] += delta * cell.term[t].second;
+                changed |= cell_tuples[pos];
+            }
+        }
+        if (heat && heat->sample()) {
+            for (uint32_t rest = changed; rest; rest &= rest - 1) {
+                int i = __builtin_ctz(rest);
+                heat->read(i, ref.key[i]);
+            }
+        }
+        profiler::scope prof(profiler::lookup);
+        const network& net = *this->net;
+        for (uint32_t rest = changed; rest; rest &= rest - 1) {
+            int i = __builtin_ctz(rest);
+            ref.value[i] = net[i][ref.key[i]];
+        }
+        ref.state = b;
+        ref.valid = true;
+        float weight_sum = ref.value[0];
         for (int i = 1; i < TUPLE_NUM; i++)
-            weight_sum += net[i][get_feature_key(b, i)];
+            weight_sum += ref.value[i];
         return weight_sum;
     }
 
+    /**
+     * the 4 slides of each of n boards, searched together in lockstep; the cells are kept in columns,
+     * i.e., cell p of candidate j is at cells[p * size + j], where j = op * n + k for board k, so that the
+     * slides and the keys of all the candidates are computed by the same (vectorized) loops
+     */
+    struct slide_batch {
+        size_t n, size;
+        std::vector<board::cell> input; // cell p of board k at input[p * n + k]
+        std::vector<board::cell> cells;
+        std::vector<board::cell> changed; // whether the slide of each board changes it
+        std::vector<board::reward> reward; // of each candidate, or -1 if the slide is illegal
+        std::vector<int> keys; // key of tuple i of candidate j at keys[i * size + j]
+        std::vector<uint32_t> legal; // the candidates which are legal slides
+        std::vector<float> value; // reward + the value of the candidate, only for the legal ones
+    };
+
+    /**
+     * slide the boards in all 4 directions, as board::slide does to each of them
+     */
+    static void slide_all(const board* boards, size_t n, slide_batch& out) {
+        // the cells of each line, from the edge which the tiles slide towards
+        static const int lines[4][4][4] = { {{0, 4, 8, 12}, {1, 5, 9, 13}, {2, 6, 10, 14}, {3, 7, 11, 15}},
+                                            {{3, 2, 1, 0}, {7, 6, 5, 4}, {11, 10, 9, 8}, {15, 14, 13, 12}},
+                                            {{12, 8, 4, 0}, {13, 9, 5, 1}, {14, 10, 6, 2}, {15, 11, 7, 3}},
+                                            {{0, 1, 2, 3}, {4, 5, 6, 7}, {8, 9, 10, 11}, {12, 13, 14, 15}} };
+        profiler::scope prof(profiler::board_op);
+        out.n = n;
+        out.size = 4 * n;
+        out.input.resize(16 * n);
+        out.cells.resize(16 * out.size);
+        out.reward.assign(out.size, 0);
+        for (size_t k = 0; k < n; k++)
+            for (int p = 0; p < 16; p++) out.input[p * n + k] = boards[k](p);
+
+        out.changed.resize(n);
+        board::cell* changed = out.changed.data();
+        for (int op = 0; op < 4; op++) {
+            std::fill_n(changed, n, 0);
+            board::reward* reward = out.reward.data() + op * n;
+            for (int l = 0; l < 4; l++) {
+                const board::cell* in[4];
+                board::cell* res[4];
+                for (int c = 0; c < 4; c++) {
+                    in[c] = out.input.data() + lines[op][l][c] * n;
+                    res[c] = out.cells.data() + lines[op][l][c] * out.size + op * n;
+                }
+                slide_lines(in[0], in[1], in[2], in[3], res[0], res[1], res[2], res[3], reward, changed, n);
+            }
+            for (size_t k = 0; k < n; k++)
+                if (!changed[k]) reward[k] = -1;
+        }
+    }
+
+    /**
+     * slide a line (cells 0 ... 3, towards cell 0) of each of n boards, and accumulate the rewards and the changes
+     */
+    static void slide_lines(const board::cell* __restrict in0, const board::cell* __restrict in1,
+                            const board::cell* __restrict in2, const board::cell* __restrict in3,
+                            board::cell* __restrict res0, board::cell* __restrict res1,
+                            board::cell* __restrict res2, board::cell* __restrict res3,
+                            board::reward* __restrict reward, board::cell* __restrict changed, size_t n) {
+        for (size_t k = 0; k < n; k++) {
+            int a0 = in0[k], a1 = in1[k], a2 = in2[k], a3 = in3[k];
+            int score = 0;
+            slide_step(a0, a1, score);
+            slide_step(a1, a2, score);
+            slide_step(a2, a3, score);
+            res0[k] = a0;
+            res1[k] = a1;
+            res2[k] = a2;
+            res3[k] = a3;
+            reward[k] += score;
+            changed[k] |= (a0 ^ in0[k]) | (a1 ^ in1[k]) | (a2 ^ in2[k]) | (a3 ^ in3[k]);
+        }
+    }
+
+    /**
+     * move or merge the tile 'cur' into 'prev' as board::slide_left does, by masks instead of branches
+     * so that the loop above is vectorized (with signed integers, since SSE2 compares only those)
+     */
+    static void slide_step(int& prev, int& cur, int& score) {
+        int shift = -(prev == 0);
+        int basic = -((prev + cur == 3) & (prev != 0) & (cur != 0)); // 1 + 2 or 2 + 1
+        int merge = -((prev > 2) & (prev == cur));
+        int moved = shift | basic | merge;
+        score += (basic & 3) + (merge & power3(cur));
+        prev = (shift & cur) | (basic & 3) | (merge & (prev + 1)) | (~moved & prev);
+        cur = ~moved & cur;
+    }
+
+    /**
+     * 3 ^ (t - 2), the reward of merging two tiles of index t (t >= 3), without a table
+     */
+    static int power3(int t) {
+        int e = t - 2;
+        int p = 1;
+        p *= (e & 1) ? 3 : 1;
+        p *= (e & 2) ? 9 : 1;
+        p *= (e & 4) ? 81 : 1;
+        p *= (e & 8) ? 6561 : 1;
+        return p;
+    }
+
+    /**
+     * the values (reward + the value of the board) of the legal candidates, which equal those of
+     * get_board_value; the keys of each tuple are computed for all the candidates at once, and then
+     * the lookups of a table are all independent of each other, so many of them are in flight at once
+     */
+    void evaluate_all(slide_batch& batch) {
+        size_t size = batch.size;
+        batch.keys.resize(TUPLE_NUM * size);
+        batch.value.resize(size);
+        {
+            profiler::scope prof(profiler::feature);
+            for (int i = 0; i < TUPLE_NUM; i++) {
+                int* key = batch.keys.data() + i * size;
+                std::fill_n(key, size, 0);
+                for (int c = 0; c < TUPLE_LEN; c++) {
+                    const board::cell* cell = batch.cells.data() + tuple_index[i][c] * size;
+                    int coef = coefficient[c];
+                    for (size_t j = 0; j < size; j++) key[j] += int(cell[j]) * coef;
+                }
+            }
+        }
+        batch.legal.clear();
+        for (size_t j = 0; j < size; j++)
+            if (batch.reward[j] != -1) batch.legal.push_back(j);
+        if (heat && heat->sample()) {
+            for (int i = 0; i < TUPLE_NUM; i++)
+                for (size_t j : batch.legal) heat->read(i, batch.keys[i * size + j]);
+        }
+        profiler::scope prof(profiler::lookup);
+        const network& net = *this->net;
+        float* value = batch.value.data();
+        const int* key = batch.keys.data();
+        for (size_t j : batch.legal) value[j] = net[0][key[j]];
+        for (int i = 1; i < TUPLE_NUM; i++) {
+            const weight& w = net[i];
+            key = batch.keys.data() + i * size;
+            for (size_t j : batch.legal) value[j] += w[key[j]];
+        }
+        for (size_t j : batch.legal) value[j] = batch.reward[j] + value[j];
+    }
+
     virtual int get_feature_key(const board& b, const int& row) {
         int key_sum = b(tuple_index[row][0]) * coefficient[0];
         for(int i = 1; i < TUPLE_LEN; i++)
@@ -185,11 +678,34 @@ protected:
         return key_sum;
     }
 
+private:
+    /**
+     * the weight tables loaded in this process, keyed by the identity of their files,
+     * with the number of deltas applied
+     */
+    struct registry_t {
+        std::mutex lock;
+        std::map<std::string, std::pair<std::weak_ptr<network>, size_t>> loaded;
+    };
+    static registry_t& registry() { static registry_t reg; return reg; }
+
 protected:
     std::default_random_engine random_engine;
-    std::uniform_int_distribution<int> random_generator;
     float learning_rate;
-    std::vector<weight> net;
+    std::shared_ptr<network> net;
+    bool shared; // whether net may be shared with other agents, see writable()
+    bool failed; // whether load=... has failed
+    std::shared_ptr<param_client> remote;
+    std::shared_ptr<eval_cache> cache;
+    std::shared_ptr<access_heatmap> heat;
+    ponder_table pondering;
+    slide_batch batched; // the buffers of take_actions
+    int depth;
+    size_t nodes;
+    const std::atomic<bool>* cancel; // set while pondering, which aborts the search once raised
+    checkpoint store;
+    size_t interval;
+    size_t episodes;
     const std::array<int, TUPLE_LEN> coefficient = {{ (int)std::pow(MAX_TILE_INDEX, 0), (int)std::pow(MAX_TILE_INDEX, 1),
                                                       (int)std::pow(MAX_TILE_INDEX, 2), (int)std::pow(MAX_TILE_INDEX, 3),
                                                       (int)std::pow(MAX_TILE_INDEX, 4), (int)std::pow(MAX_TILE_INDEX, 5) }};
@@ -232,6 +748,30 @@ protected:
                                                                              {{11, 10, 9, 5, 8, 4}},
                                                                              {{11, 7, 10, 6, 9, 5}},
                                                                              {{7, 3, 6, 2, 5, 1}} }};
+    const std::array<uint32_t, 16> cell_tuples = tuples_of_cells(tuple_index); // the tuples covering each cell
+    struct cell_terms_t {
+        int num;
+        std::array<std::pair<int, int>, TUPLE_NUM> term; // (tuple, coefficient)
+    };
+    const std::array<cell_terms_t, 16> cell_terms = terms_of_cells(tuple_index, coefficient); // ... and their weights in the keys
+
+private:
+    static std::array<cell_terms_t, 16> terms_of_cells(const std::array<std::array<int, TUPLE_LEN>, TUPLE_NUM>& tuples, const std::array<int, TUPLE_LEN>& coef) {
+        std::array<cell_terms_t, 16> terms = {};
+        for (int i = 0; i < TUPLE_NUM; i++)
+            for (int k = 0; k < TUPLE_LEN; k++) {
+                cell_terms_t& cell = terms[tuples[i][k]];
+                cell.term[cell.num++] = { i, coef[k] };
+            }
+        return terms;
+    }
+    static std::array<uint32_t, 16> tuples_of_cells(const std::array<std::array<int, TUPLE_LEN>, TUPLE_NUM>& tuples) {
+        static_assert(TUPLE_NUM <= 32, "the tuples of a cell are kept in a 32-bit mask");
+        std::array<uint32_t, 16> masks = {};
+        for (int i = 0; i < TUPLE_NUM; i++)
+            for (int pos : tuples[i]) masks[pos] |= 1u << i;
+        return masks;
+    }
 };
 
 /**
@@ -271,44 +811,14 @@ public:
 class rndenv : public weight_agent {
 public:
     rndenv(const std::string& args = "") : weight_agent("name=random role=environment " + args) {}
+    rndenv(const rndenv& share, const std::string& args) : weight_agent(share, args) {}
 
     virtual action take_action(const board& after) {
+        profiler::scope prof(profiler::search);
         int op = after.get_last_op();
         if (op >= 0 && op <= 3) {
-            board b = board(after);
-            int worst_pos = -1;
-            board::cell worst_hint = -1;
-            board::cell hint_flag = 0;
-            float worst_expect = BIG_FLOAT;
-            std::vector<board::cell> next_bag;
-
-            b.remove_tile(b.get_next_tile());
-            next_bag = b.get_bag();
-            if (b.get_tile_counter() >= 20 && b.get_max_tile() >= 7) {
-                random_generator.param(std::uniform_int_distribution<>::param_type {4, (int)b.get_max_tile() - 3});
-                next_bag.emplace_back(random_generator(random_engine));
-            }
-
-            for (auto& pos : side_space[op]) {
-                if (after(pos) != 0) continue;
-                hint_flag = 0;
-                for (auto& next_hint : next_bag) {
-                    if (next_hint <= hint_flag)
-                        continue;
-                    else
-                        hint_flag = next_hint;
-                    b = board(after);
-                    board::reward reward = b.place(pos, b.get_next_tile(), next_hint);
-                    if (reward == -1) continue;
-                    float value = reward + get_before_state(b, EVIL_START_LEVEL);
-                    if (value < worst_expect) {
-                        worst_expect = value;
-                        worst_pos = pos;
-                        worst_hint = next_hint;
-                    }
-                }
-            }
-            return action::place(worst_pos, after.get_next_tile(), worst_hint);
+            action a = pondered(after);
+            return a.type() == action::place::type ? a : search_action(after);
         }
         else if (op == -1) {
             board b = board(after);
@@ -327,6 +837,114 @@ public:
         }
         return action();
     }
+
+    /**
+     * search the placements for each possible slide of the player
+     */
+    virtual void ponder(const board& before, const std::atomic<bool>& stop) {
+        profiler::scope prof(profiler::search);
+        std::vector<board> states;
+        for (auto& op : all_op) {
+            board b = before;
+            if (b.slide(op) != -1) states.push_back(b);
+        }
+        ponder_states(states, stop, [this](const board& after) { return search_action(after); });
+    }
+
+    /**
+     * the actions of n after-states at once, e.g., of the games played in lockstep; with depth=1, the
+     * placements of all the states are searched together, and are the same as those of take_action
+     * the other states (e.g., the openings, which are random) are taken by opener(k).take_action
+     */
+    void take_actions(const board* afters, size_t n, action* moves) {
+        take_actions(afters, n, moves, [this](size_t k) -> agent& { return *this; });
+    }
+    template<typename opener_t>
+    void take_actions(const board* afters, size_t n, action* moves, opener_t opener) {
+        profiler::scope prof(profiler::search);
+        placed.clear();
+        outcomes.clear();
+        offset.assign(n + 1, 0);
+        for (size_t k = 0; k < n; k++) {
+            int op = afters[k].get_last_op();
+            if (depth == 1 && op >= 0 && op <= 3) {
+                for (const successor::outcome& next : successor(afters[k], side_space[op])) {
+                    board b = afters[k];
+                    board::reward reward;
+                    {
+                        profiler::scope prof(profiler::board_op);
+                        reward = next.apply(b);
+                    }
+                    placed.push_back(b);
+                    outcomes.emplace_back(next, reward);
+                }
+            }
+            offset[k + 1] = placed.size();
+        }
+        slide_all(placed.data(), placed.size(), batched);
+        evaluate_all(batched);
+        nodes += placed.size();
+
+        size_t m = placed.size();
+        for (size_t k = 0; k < n; k++) {
+            if (offset[k] == offset[k + 1]) {
+                moves[k] = opener(k).take_action(afters[k]);
+                continue;
+            }
+            int worst_pos = -1;
+            board::cell worst_hint = -1;
+            float worst_expect = BIG_FLOAT;
+            for (size_t o = offset[k]; o < offset[k + 1]; o++) {
+                float best_expect = SMALL_FLOAT;
+                bool move_flag = false;
+                for (auto& op : all_op) {
+                    size_t j = op * m + o;
+                    if (batched.reward[j] == -1) continue;
+                    if (batched.value[j] > best_expect) {
+                        best_expect = batched.value[j];
+                        move_flag = true;
+                    }
+                }
+                float value = outcomes[o].second + (move_flag ? best_expect : 0.0f);
+                if (value < worst_expect) {
+                    worst_expect = value;
+                    worst_pos = outcomes[o].first.pos;
+                    worst_hint = outcomes[o].first.hint;
+                }
+            }
+            moves[k] = action::place(worst_pos, afters[k].get_next_tile(), worst_hint);
+        }
+    }
+
+private:
+    std::vector<board> placed; // the buffers of take_actions, the boards after each outcome
+    std::vector<std::pair<successor::outcome, board::reward>> outcomes;
+    std::vector<size_t> offset; // the first outcome of each state
+
+    /**
+     * the placement (and the next hint) with the worst expectation for the player
+     */
+    action search_action(const board& after) {
+        int worst_pos = -1;
+        board::cell worst_hint = -1;
+        float worst_expect = BIG_FLOAT;
+
+        for (const successor::outcome& next : successor(after, side_space[after.get_last_op()])) {
+            board b = after;
+            board::reward reward;
+            {
+                profiler::scope prof(profiler::board_op);
+                reward = next.apply(b);
+            }
+            float value = reward + get_before_state(b, EVIL_START_LEVEL);
+            if (value < worst_expect) {
+                worst_expect = value;
+                worst_pos = next.pos;
+                worst_hint = next.hint;
+            }
+        }
+        return action::place(worst_pos, after.get_next_tile(), worst_hint);
+    }
 };
 
 /**
@@ -334,54 +952,150 @@ public:
  */
 class TDL_player : public weight_agent {
 public:
-    TDL_player(const std::string& args = "") : weight_agent("name=dummy role=player " + args) {}
+    /**
+     * the after-states and the rewards of an episode, all the learner needs
+     */
+    typedef std::vector<std::pair<board, board::reward>> trajectory;
+
+public:
+    TDL_player(const std::string& args = "") : weight_agent("name=dummy role=player " + args), td_error(0), td_count(0) {}
+    TDL_player(const TDL_player& share, const std::string& args) : weight_agent(share, args), td_error(0), td_count(0) {}
+
+    virtual void open_episode(const std::string& flag = "") {
+        after_states.clear();
+    }
 
     virtual action take_action(const board& before) {
-        int best_op = -1;
-        float best_weight = SMALL_FLOAT;
-        board best_board;
-        board::reward best_reward = -1;
+        profiler::scope prof(profiler::search);
+        action a = pondered(before);
+        if (a.type() != action::slide::type) a = search_action(before);
+        board b = before;
+        board::reward reward = a.apply(b);
+        if (reward == -1) return action();
+        after_states.emplace_back(std::make_pair(b, reward));
+        return a;
+    }
 
-        for (auto& op : all_op) {
-            board b = board(before);
-            board::reward reward = b.slide(op);
-            if(reward == -1) continue;
-            float weight = reward + get_after_state(b, PLAYER_START_LEVEL);
-            if (weight > best_weight) {
-                best_op = op;
-                best_weight = weight;
-                best_board = board(b);
-                best_reward = reward;
-            }
+    /**
+     * search the slides for each possible placement of the environment
+     */
+    virtual void ponder(const board& after, const std::atomic<bool>& stop) {
+        int op = after.get_last_op();
+        if (op < 0 || op > 3) return;
+        profiler::scope prof(profiler::search);
+        std::vector<board> states;
+        for (const successor::outcome& next : successor(after, side_space[op])) {
+            board b = after;
+            next.apply(b);
+            states.push_back(b);
         }
+        ponder_states(states, stop, [this](const board& before) { return search_action(before); });
+    }
 
-        if (best_op != -1) {
-            after_states.emplace_back(std::make_pair(best_board, best_reward));
-            return action::slide(best_op);
+    /**
+     * the slides of n before-states at once, e.g., of the games played in lockstep; with depth=1, the
+     * after-states of all the states are evaluated together, and the slides are the same as those of take_action
+     * the after-states are not kept for training, since the states may belong to different games
+     */
+    void take_actions(const board* befores, size_t n, action* moves) {
+        profiler::scope prof(profiler::search);
+        if (depth != 1) {
+            for (size_t k = 0; k < n; k++) moves[k] = search_action(befores[k]);
+            return;
         }
-        return action();
+        slide_all(befores, n, batched);
+        evaluate_all(batched);
+        for (size_t k = 0; k < n; k++) {
+            int best_op = -1;
+            float best_weight = SMALL_FLOAT;
+            for (auto& op : all_op) {
+                size_t j = op * n + k;
+                if (batched.reward[j] == -1) continue;
+                if (batched.value[j] > best_weight) {
+                    best_op = op;
+                    best_weight = batched.value[j];
+                }
+            }
+            moves[k] = best_op != -1 ? action::slide(best_op) : action();
+        }
+    }
+
+    /**
+     * hand over the trajectory of the current episode, e.g., from an actor to the learner
+     */
+    trajectory take_trajectory() {
+        trajectory states;
+        states.swap(after_states);
+        return states;
+    }
+
+    /**
+     * learn from the trajectory played by another agent
+     */
+    void training(trajectory&& states) {
+        after_states = std::move(states);
+        training();
     }
 
     virtual void training() {
+        profiler::scope prof(profiler::update);
         train_weight(after_states[after_states.size()-1].first);
         for (int i = after_states.size() - 1; i > 0; i--)
             train_weight(after_states[i-1].first, after_states[i].first, after_states[i].second);
         after_states.clear();
+        telemetry::record_error(td_error, td_count);
+        td_error = 0;
+        td_count = 0;
+        profiler::scope sync(profiler::io);
+        if (remote) remote->close_episode(writable());
+        checkpoint_weights();
     }
 
 private:
+    /**
+     * the slide with the best expectation
+     */
+    action search_action(const board& before) {
+        int best_op = -1;
+        float best_weight = SMALL_FLOAT;
+
+        for (auto& op : all_op) {
+            board b = board(before);
+            board::reward reward;
+            {
+                profiler::scope prof(profiler::board_op);
+                reward = b.slide(op);
+            }
+            if(reward == -1) continue;
+            float weight = reward + get_after_state(b, PLAYER_START_LEVEL);
+            if (weight > best_weight) {
+                best_op = op;
+                best_weight = weight;
+            }
+        }
+        return best_op != -1 ? action::slide(best_op) : action();
+    }
+
     virtual void train_weight(const board& b) {
-        float err = learning_rate * (0 - get_board_value(b));
+        float delta = 0 - get_board_value(b);
+        float err = learning_rate * delta;
         for (int i = 0; i < TUPLE_NUM; i++)
-            net[i][get_feature_key(b, i)] += err;
+            update(i, get_feature_key(b, i), err);
+        td_error += std::fabs(delta);
+        td_count++;
     }
 
     virtual void train_weight(const board& last_b, const board& b, const board::reward& reward) {
-        float err = learning_rate * (get_board_value(b) + reward - get_board_value(last_b));
+        float delta = get_board_value(b) + reward - get_board_value(last_b);
+        float err = learning_rate * delta;
         for (int i = 0; i < TUPLE_NUM; i++)
-            net[i][get_feature_key(last_b, i)] += err;
+            update(i, get_feature_key(last_b, i), err);
+        td_error += std::fabs(delta);
+        td_count++;
     }
 
 private:
-    std::vector<std::pair<board, board::reward>> after_states;
+    trajectory after_states;
+    double td_error; // the sum of the absolute TD errors of the current episode, for the telemetry
+    size_t td_count;
 };
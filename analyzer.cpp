@@ -0,0 +1,240 @@
+/**
+ * Offline analyzer for the records of episodes (dump files or saved statistics)
+ * use 'make analyzer' to compile the source
+ *
+ * the files are memory-mapped and split into chunks at line boundaries, the chunks are parsed
+ * and replayed by several threads without allocation, and only the aggregates are kept,
+ * so the memory usage does not depend on the size of the files
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <iterator>
+#include <string>
+#include <vector>
+#include <array>
+#include <thread>
+#include <chrono>
+#include <numeric>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "board.h"
+#include "action.h"
+#include "histogram.h"
+
+/**
+ * the aggregates of a set of episodes, which can be merged
+ */
+struct aggregate {
+    size_t episodes = 0;
+    size_t steps = 0, play_steps = 0, evil_steps = 0;
+    uint64_t duration = 0, play_time = 0, evil_time = 0; // in milliseconds
+    uint64_t score_sum = 0;
+    board::reward score_max = 0;
+    std::array<size_t, 64> ending = {}; // the number of episodes ended with each max tile
+    histogram scores;
+    histogram play_latency, evil_latency; // in nanoseconds, but recorded in milliseconds
+    size_t skipped = 0;
+
+    aggregate& operator +=(const aggregate& a) {
+        episodes += a.episodes;
+        steps += a.steps, play_steps += a.play_steps, evil_steps += a.evil_steps;
+        duration += a.duration, play_time += a.play_time, evil_time += a.evil_time;
+        score_sum += a.score_sum;
+        score_max = std::max(score_max, a.score_max);
+        for (size_t t = 0; t < ending.size(); t++) ending[t] += a.ending[t];
+        scores += a.scores;
+        play_latency += a.play_latency;
+        evil_latency += a.evil_latency;
+        skipped += a.skipped;
+        return *this;
+    }
+};
+
+/**
+ * parse an unsigned decimal number, and advance the cursor
+ */
+static uint64_t parse_number(const char*& p, const char* end) {
+    uint64_t v = 0;
+    while (p < end && *p >= '0' && *p <= '9') v = v * 10 + (*p++ - '0');
+    return v;
+}
+
+/**
+ * the time of a meta field "tag@when"
+ */
+static uint64_t parse_when(const char* begin, const char* end) {
+    const char* at = static_cast<const char*>(std::memchr(begin, '@', end - begin));
+    if (!at) return 0;
+    const char* p = at + 1;
+    return parse_number(p, end);
+}
+
+/**
+ * replay an episode record "open|moves|close", return false if the record is malformed
+ * lines which are not records (e.g., the latency histograms of a saved statistic) are ignored
+ */
+static bool analyze(const char* line, const char* end, aggregate& sum) {
+    const char* moves = static_cast<const char*>(std::memchr(line, '|', end - line));
+    if (!moves) return true;
+    const char* close = static_cast<const char*>(std::memchr(moves + 1, '|', end - moves - 1));
+    if (!close) return false;
+
+    board state;
+    board::reward score = 0;
+    size_t play_steps = 0, evil_steps = 0;
+    uint64_t play_time = 0, evil_time = 0;
+    for (const char* p = moves + 1; p + 2 <= close; ) {
+        action move = action::parse(p, 2);
+        p += 2;
+        board::reward reward = 0;
+        uint64_t time = 0;
+        if (p < close && *p == '[') reward = parse_number(++p, close), p++;
+        if (p < close && *p == '(') time = parse_number(++p, close), p++;
+        if (move.apply(state) == -1) return false;
+        score += reward;
+        if (move.type() == action::slide::type) {
+            play_steps++, play_time += time;
+            if (time) sum.play_latency.add(time * 1000000);
+        } else {
+            evil_steps++, evil_time += time;
+            if (time) sum.evil_latency.add(time * 1000000);
+        }
+    }
+
+    sum.episodes++;
+    sum.steps += play_steps + evil_steps;
+    sum.play_steps += play_steps;
+    sum.evil_steps += evil_steps;
+    sum.play_time += play_time;
+    sum.evil_time += evil_time;
+    sum.duration += parse_when(close + 1, end) - parse_when(line, moves);
+    sum.score_sum += score;
+    sum.score_max = std::max(sum.score_max, score);
+    sum.scores.add(score);
+    size_t tile = *std::max_element(&state(0), &state(16)); // the largest tile on the board, as statistic::show
+    sum.ending[std::min<size_t>(tile, sum.ending.size() - 1)]++;
+    return true;
+}
+
+/**
+ * analyze the lines starting within [begin, end) of a mapped file which ends at 'limit'
+ */
+static void analyze_chunk(const char* begin, const char* end, const char* limit, aggregate& sum) {
+    for (const char* line = begin; line < end; ) {
+        const char* eol = static_cast<const char*>(std::memchr(line, '\n', limit - line));
+        if (!eol) eol = limit;
+        if (eol > line && !analyze(line, eol, sum)) sum.skipped++;
+        line = eol + 1;
+    }
+}
+
+/**
+ * analyze a file by several threads, return false if the file cannot be mapped
+ */
+static bool analyze_file(const std::string& path, size_t threads, aggregate& total) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd == -1) return false;
+    struct stat st;
+    if (::fstat(fd, &st) != 0) { ::close(fd); return false; }
+    size_t size = st.st_size;
+    if (size == 0) { ::close(fd); return true; }
+    void* map = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) return false;
+    ::madvise(map, size, MADV_SEQUENTIAL);
+
+    const char* data = static_cast<const char*>(map);
+    const char* limit = data + size;
+    // the chunk boundaries are moved forward to the line starts
+    std::vector<const char*> cut(threads + 1, limit);
+    cut[0] = data;
+    for (size_t i = 1; i < threads; i++) {
+        const char* p = std::max(data + size / threads * i, cut[i - 1]);
+        const char* eol = static_cast<const char*>(std::memchr(p, '\n', limit - p));
+        cut[i] = eol ? eol + 1 : limit;
+    }
+
+    std::vector<aggregate> part(threads);
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < threads; i++)
+        workers.emplace_back(analyze_chunk, cut[i], cut[i + 1], limit, std::ref(part[i]));
+    for (std::thread& worker : workers) worker.join();
+    for (const aggregate& a : part) total += a;
+
+    ::munmap(map, size);
+    return true;
+}
+
+/**
+ * show the aggregates in the format of statistic::show,
+ * followed by the distributions of the scores and the move latencies
+ */
+static void show(const aggregate& sum) {
+    const std::array<int, 15> base = {{0, 1, 2, 3, 6, 12, 24, 48, 96, 192, 384, 768, 1536, 3072, 6144}};
+    size_t n = std::max<size_t>(sum.episodes, 1);
+
+    std::cout << std::fixed << std::setprecision(0);
+    std::cout << sum.episodes << "\t";
+    std::cout << "avg = " << (sum.score_sum / n) << ", ";
+    std::cout << "max = " << (sum.score_max) << ", ";
+    std::cout << "ops = " << (sum.steps * 1000.0 / sum.duration);
+    std::cout <<     " (" << (sum.play_steps * 1000.0 / sum.play_time);
+    std::cout <<      "|" << (sum.evil_steps * 1000.0 / sum.evil_time) << ")";
+    std::cout << std::endl;
+
+    std::cout << std::setprecision(1);
+    for (size_t t = 0, c = 0; c < sum.episodes && t < sum.ending.size(); c += sum.ending[t++]) {
+        if (sum.ending[t] == 0) continue;
+        size_t accu = std::accumulate(sum.ending.begin() + t, sum.ending.end(), size_t(0));
+        std::cout << "\t" << (t < base.size() ? base[t] : 0);
+        std::cout << "\t" << (accu * 100.0 / n) << "%";
+        std::cout << "\t" "(" << (sum.ending[t] * 100.0 / n) << "%" ")";
+        std::cout << std::endl;
+    }
+
+    std::cout << "\t" "score";
+    for (double q : { 0.1, 0.25, 0.5, 0.75, 0.9, 0.99 })
+        std::cout << "\t" "p" << int(q * 100) << " = " << sum.scores.percentile(q);
+    std::cout << std::endl;
+    if (sum.play_latency.count()) std::cout << "\t" "play" "\t" << sum.play_latency.summary() << std::endl;
+    if (sum.evil_latency.count()) std::cout << "\t" "evil" "\t" << sum.evil_latency.summary() << std::endl;
+    if (sum.skipped) std::cout << "\t" "(" << sum.skipped << " malformed lines skipped)" << std::endl;
+    std::cout << std::endl;
+}
+
+int main(int argc, const char* argv[]) {
+    std::cout << "Threes-Analyzer: ";
+    std::copy(argv, argv + argc, std::ostream_iterator<const char*>(std::cout, " "));
+    std::cout << std::endl << std::endl;
+
+    size_t threads = std::max(std::thread::hardware_concurrency(), 1u);
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; i++) {
+        std::string para(argv[i]);
+        if (para.find("--threads=") == 0) {
+            threads = std::max<size_t>(std::stoull(para.substr(para.find("=") + 1)), 1);
+        } else {
+            files.push_back(para);
+        }
+    }
+
+    aggregate total;
+    auto start = std::chrono::steady_clock::now();
+    for (const std::string& path : files) {
+        if (!analyze_file(path, threads, total)) {
+            std::cerr << "cannot open " << path << std::endl;
+            std::exit(-1);
+        }
+    }
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    show(total);
+    std::cout << "analyzed " << total.episodes << " episodes by " << threads << " threads in " << std::setprecision(3) << sec << "s" << std::endl;
+    return 0;
+}
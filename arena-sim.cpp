@@ -0,0 +1,395 @@
+/**
+ * Local stand-in of the arena server for load testing the shell
+ * use 'make arena-sim' to compile the source
+ *
+ * the simulator starts one or more shell processes, logs in, and plays many concurrent matches with them
+ * through the arena protocol ("@ login", "#id open tag", "#id ?", "#id move", "#id close score=..."),
+ * where the simulator itself plays the other side randomly (taking --think milliseconds per move, to model
+ * a remote opponent); the requests ("#id ?") can be paced by a rate,
+ * a request which is not answered within the deadline (or answered by an illegal move) ends its match,
+ * and the throughput and the latency percentiles of the requests are reported
+ *
+ * e.g. ./arena-sim --procs=2 --matches=8 --games=100 --rate=500 --deadline=1000 -- ./Threes --shell --play="name=cp load=weights.bin"
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <iterator>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <sstream>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <csignal>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include "board.h"
+#include "action.h"
+#include "histogram.h"
+
+typedef std::chrono::steady_clock clock_type;
+
+/**
+ * a shell process, connected by pipes
+ */
+struct shell_proc {
+    pid_t pid = -1;
+    int in = -1;  // the stdin of the shell
+    int out = -1; // the stdout of the shell
+    std::string buf;
+    std::string agent; // the name of the agent under test
+    bool alive = true;
+
+    bool spawn(const std::vector<const char*>& argv) {
+        int down[2], up[2];
+        if (::pipe(down) != 0 || ::pipe(up) != 0) return false;
+        pid = ::fork();
+        if (pid == 0) {
+            ::dup2(down[0], 0);
+            ::dup2(up[1], 1);
+            ::close(down[0]), ::close(down[1]), ::close(up[0]), ::close(up[1]);
+            ::execvp(argv[0], const_cast<char* const*>(argv.data()));
+            ::_exit(127);
+        }
+        ::close(down[0]), ::close(up[1]);
+        in = down[1], out = up[0];
+        return pid > 0;
+    }
+
+    void send(const std::string& line) {
+        std::string data = line + '\n';
+        for (size_t off = 0; off < data.size() && alive; ) {
+            ssize_t n = ::write(in, data.data() + off, data.size() - off);
+            if (n <= 0) alive = false;
+            else off += n;
+        }
+    }
+
+    /**
+     * read the available output, return false if the shell has closed its output
+     */
+    bool receive() {
+        char chunk[65536];
+        ssize_t n = ::read(out, chunk, sizeof(chunk));
+        if (n <= 0) return alive = false;
+        buf.append(chunk, n);
+        return true;
+    }
+    bool next_line(std::string& line) {
+        size_t eol = buf.find('\n');
+        if (eol == std::string::npos) return false;
+        line = buf.substr(0, eol);
+        buf.erase(0, eol + 1);
+        return true;
+    }
+
+    void close() {
+        if (in != -1) ::close(in), in = -1;
+        if (out != -1) ::close(out), out = -1;
+        if (pid > 0) ::waitpid(pid, nullptr, 0), pid = -1;
+    }
+};
+
+/**
+ * a match between the agent under test and the simulator
+ */
+struct match {
+    std::string id;
+    size_t proc = 0;
+    board state;
+    board::reward score = 0;
+    size_t step = 0;
+    bool open = false; // accepted by the shell
+    bool waiting = false; // a request has been sent
+    bool thinking = false; // the simulator is to move at 'due'
+    clock_type::time_point sent, due;
+};
+
+/**
+ * the simulator's own moves
+ */
+class opponent {
+public:
+    opponent(unsigned seed) : engine(seed) {}
+
+    action place(const board& after) {
+        static const std::array<std::array<int, 4>, 4> side = {{ {{12, 13, 14, 15}}, {{0, 4, 8, 12}}, {{0, 1, 2, 3}}, {{3, 7, 11, 15}} }};
+        std::vector<int> space;
+        int op = after.get_last_op();
+        for (int pos = 0; pos < 16; pos++) {
+            bool on_side = op < 0 || op > 3 || std::find(side[op].begin(), side[op].end(), pos) != side[op].end();
+            if (on_side && after(pos) == 0) space.push_back(pos);
+        }
+        if (space.empty()) return action();
+        board b = after;
+        b.remove_tile(b.get_next_tile());
+        std::vector<board::cell> bag = b.get_bag();
+        board::cell hint = bag[std::uniform_int_distribution<size_t>(0, bag.size() - 1)(engine)];
+        if (after.get_tile_counter() >= 20 && after.get_max_tile() >= 7 && std::uniform_int_distribution<int>(0, 20)(engine) == 0)
+            hint = std::uniform_int_distribution<int>(4, after.get_max_tile() - 3)(engine);
+        int pos = space[std::uniform_int_distribution<size_t>(0, space.size() - 1)(engine)];
+        return action::place(pos, after.get_next_tile(), hint);
+    }
+
+    action slide(const board& before) {
+        std::vector<unsigned> legal;
+        for (unsigned op = 0; op < 4; op++)
+            if (board(before).slide(op) != -1) legal.push_back(op);
+        if (legal.empty()) return action();
+        return action::slide(legal[std::uniform_int_distribution<size_t>(0, legal.size() - 1)(engine)]);
+    }
+
+private:
+    std::default_random_engine engine;
+};
+
+static std::string encode(const action& a) {
+    std::stringstream ss;
+    ss << a;
+    if (a.type() == action::place::type) ss << '+' << action::index()[std::min(action::place(a).hint(), 36u)];
+    return ss.str();
+}
+
+static bool can_slide(const board& b) {
+    for (unsigned op = 0; op < 4; op++)
+        if (board(b).slide(op) != -1) return true;
+    return false;
+}
+
+int main(int argc, const char* argv[]) {
+    std::cout << "Threes-Arena-Sim: ";
+    std::copy(argv, argv + argc, std::ostream_iterator<const char*>(std::cout, " "));
+    std::cout << std::endl << std::endl;
+
+    size_t procs = 1, matches = 4, games = 100;
+    double rate = 0; // requests per second, 0 for unlimited
+    long deadline = 5000; // milliseconds
+    long think = 0; // milliseconds per move of the simulator
+    bool test_play = true;
+    unsigned seed = 1;
+    std::vector<const char*> command;
+    for (int i = 1; i < argc; i++) {
+        std::string para(argv[i]);
+        if (para == "--") {
+            command.assign(argv + i + 1, argv + argc);
+            break;
+        } else if (para.find("--procs=") == 0) {
+            procs = std::max<size_t>(std::stoull(para.substr(para.find("=") + 1)), 1);
+        } else if (para.find("--matches=") == 0) {
+            matches = std::max<size_t>(std::stoull(para.substr(para.find("=") + 1)), 1);
+        } else if (para.find("--games=") == 0) {
+            games = std::stoull(para.substr(para.find("=") + 1));
+        } else if (para.find("--rate=") == 0) {
+            rate = std::stod(para.substr(para.find("=") + 1));
+        } else if (para.find("--think=") == 0) {
+            think = std::stol(para.substr(para.find("=") + 1));
+        } else if (para.find("--deadline=") == 0) {
+            deadline = std::stol(para.substr(para.find("=") + 1));
+        } else if (para.find("--side=") == 0) {
+            test_play = para.substr(para.find("=") + 1) != "evil";
+        } else if (para.find("--seed=") == 0) {
+            seed = std::stoul(para.substr(para.find("=") + 1));
+        }
+    }
+    if (command.empty()) {
+        std::cerr << "usage: arena-sim [--procs=N] [--matches=N] [--games=N] [--rate=R] [--deadline=MS] [--think=MS] [--side=play|evil] -- ./Threes --shell ..." << std::endl;
+        return -1;
+    }
+    command.push_back(nullptr);
+    std::signal(SIGPIPE, SIG_IGN);
+
+    // start the shells and log in, the agent under test is the first one of the requested role
+    std::vector<shell_proc> shell(procs);
+    for (shell_proc& sh : shell) {
+        if (!sh.spawn(command)) {
+            std::cerr << "cannot start " << command[0] << std::endl;
+            return -1;
+        }
+        sh.send("@ login");
+        for (std::string line; sh.agent.empty() && (sh.next_line(line) || sh.receive()); ) {
+            if (line.find("@ login") != 0) continue;
+            std::stringstream ss(line.substr(7));
+            for (std::string who; ss >> who; ) {
+                // the account name comes first, then the agents as name(role)
+                size_t open = who.find('(');
+                if (open == std::string::npos || open == 0 || who.back() != ')') continue;
+                if (who[open + 1] == (test_play ? 'p' : 'e')) sh.agent = who.substr(0, open);
+            }
+            if (sh.agent.empty()) sh.agent = "?";
+        }
+        if (sh.agent.empty() || sh.agent == "?") {
+            std::cerr << "no " << (test_play ? "player" : "environment") << " agent in " << command[0] << std::endl;
+            return -1;
+        }
+    }
+
+    opponent self(seed);
+    std::map<std::string, match> ongoing;
+    std::deque<std::string> requests; // the matches which are waiting to send a request
+    size_t opened = 0, finished = 0, timeouts = 0, illegal = 0, rejected = 0, served = 0;
+    board::reward score_sum = 0;
+    histogram latency;
+    auto start = clock_type::now();
+    auto token_time = start;
+
+    auto open_match = [&](size_t proc) {
+        if (opened >= games || !shell[proc].alive) return;
+        std::stringstream id;
+        id << "#S" << std::setw(6) << std::setfill('0') << (opened++);
+        match& m = ongoing[id.str()];
+        m.id = id.str();
+        m.proc = proc;
+        std::string tag = test_play ? shell[proc].agent + ":sim" : "sim:" + shell[proc].agent;
+        shell[proc].send(m.id + " open " + tag);
+    };
+    auto close_match = [&](const std::string& id, const std::string& flag) {
+        match& m = ongoing[id];
+        if (m.open) shell[m.proc].send(m.id + " close " + flag);
+        score_sum += m.score;
+        finished++;
+        size_t proc = m.proc;
+        ongoing.erase(id);
+        open_match(proc);
+    };
+    // let the simulator move until the agent under test is to move, then queue a request
+    // each move of the simulator takes 'think' milliseconds, unless it is 'ready' to move
+    auto advance = [&](const std::string& id, bool ready) {
+        match& m = ongoing[id];
+        while (true) {
+            bool play_turn = m.step >= 9 && (m.step & 1);
+            if (play_turn && !can_slide(m.state)) {
+                close_match(id, "score=" + std::to_string(m.score));
+                return;
+            }
+            if (play_turn == test_play) {
+                requests.push_back(id);
+                return;
+            }
+            if (think > 0 && !ready) {
+                m.thinking = true;
+                m.due = clock_type::now() + std::chrono::milliseconds(think);
+                return;
+            }
+            ready = false;
+            action a = play_turn ? self.slide(m.state) : self.place(m.state);
+            board::reward r = a.apply(m.state);
+            if (r == -1) {
+                close_match(id, "score=" + std::to_string(m.score));
+                return;
+            }
+            m.score += r;
+            m.step++;
+            shell[m.proc].send(m.id + " " + encode(a));
+        }
+    };
+
+    for (size_t p = 0; p < procs; p++)
+        for (size_t i = 0; i < matches; i++) open_match(p);
+
+    while (ongoing.size()) {
+        auto now = clock_type::now();
+        // make the moves of the simulator which are due
+        std::vector<std::string> due;
+        for (auto& it : ongoing)
+            if (it.second.thinking && it.second.due <= now) due.push_back(it.first);
+        for (const std::string& id : due) {
+            ongoing[id].thinking = false;
+            advance(id, true);
+        }
+        // send the pending requests paced by the rate
+        while (requests.size() && (rate <= 0 || token_time <= now)) {
+            auto it = ongoing.find(requests.front());
+            requests.pop_front();
+            if (it == ongoing.end()) continue;
+            match& m = it->second;
+            m.waiting = true;
+            m.sent = clock_type::now();
+            shell[m.proc].send(m.id + " ?");
+            if (rate > 0) token_time = std::max(token_time, now) + std::chrono::nanoseconds(long(1e9 / rate));
+        }
+        // enforce the deadlines
+        long wait = 100;
+        std::vector<std::string> expired;
+        for (auto& it : ongoing) {
+            const match& m = it.second;
+            if (!m.waiting) continue;
+            long spent = std::chrono::duration_cast<std::chrono::milliseconds>(now - m.sent).count();
+            if (spent >= deadline) expired.push_back(m.id);
+            else wait = std::min(wait, deadline - spent);
+        }
+        for (const std::string& id : expired) {
+            timeouts++;
+            close_match(id, "timeout");
+        }
+        for (auto& it : ongoing)
+            if (it.second.thinking) wait = std::min<long>(wait, std::max<long>(0, std::chrono::duration_cast<std::chrono::milliseconds>(it.second.due - now).count()));
+        if (requests.size() && rate > 0)
+            wait = std::min<long>(wait, std::max<long>(0, std::chrono::duration_cast<std::chrono::milliseconds>(token_time - now).count()));
+
+        // collect the replies
+        std::vector<pollfd> fds;
+        for (shell_proc& sh : shell) fds.push_back({ sh.alive ? sh.out : -1, POLLIN, 0 });
+        if (::poll(fds.data(), fds.size(), int(wait)) < 0) break;
+        bool alive = false;
+        for (size_t p = 0; p < procs; p++) {
+            if (fds[p].revents) shell[p].receive();
+            alive |= shell[p].alive;
+            for (std::string line; shell[p].next_line(line); ) {
+                std::stringstream ss(line);
+                std::string id, what, arg;
+                ss >> id >> what >> arg;
+                auto it = ongoing.find(id);
+                if (it == ongoing.end()) continue; // finished already, or not a match
+                match& m = it->second;
+                if (what == "open") {
+                    if (arg == "accept") {
+                        m.open = true;
+                        advance(id, false);
+                    } else {
+                        rejected++;
+                        close_match(id, "reject");
+                    }
+                } else if (m.waiting) {
+                    m.waiting = false;
+                    latency.add(std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - m.sent).count());
+                    served++;
+                    action a = action::parse(what.data(), what.size());
+                    bool expected = a.type() == (test_play ? action::slide::type : action::place::type);
+                    board::reward r = expected ? a.apply(m.state) : -1;
+                    if (r == -1) {
+                        illegal++;
+                        close_match(id, "illegal");
+                        continue;
+                    }
+                    m.score += r;
+                    m.step++;
+                    advance(id, false);
+                }
+            }
+        }
+        if (!alive) {
+            std::cerr << "the shells have exited" << std::endl;
+            break;
+        }
+    }
+
+    double sec = std::chrono::duration<double>(clock_type::now() - start).count();
+    for (shell_proc& sh : shell) {
+        sh.send("@ exit");
+        sh.close();
+    }
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "games: " << finished << " in " << sec << "s (" << (finished / sec) << " games/s), ";
+    std::cout << "avg score = " << (finished ? score_sum / long(finished) : 0) << std::endl;
+    std::cout << "requests: " << served << " (" << (served / sec) << " requests/s), ";
+    std::cout << "timeouts = " << timeouts << ", illegal = " << illegal << ", rejected = " << rejected << std::endl;
+    std::cout << "latency: " << latency.summary() << std::endl;
+    return (timeouts || illegal) ? 1 : 0;
+}
@@ -1,10 +1,11 @@
 #pragma once
-#include <fstream>
+#include <sstream>
 #include <memory>
 #include <unordered_map>
 #include <string>
 #include "agent.h"
 #include "episode.h"
+#include "dump.h"
 
 class arena {
 public:
@@ -17,6 +18,15 @@ public:
             agent& who = take_turns(*play, *evil);
             return who.take_action(state());
         }
+        /**
+         * our agent if the opponent (a dummy agent, played remotely) is to move next, otherwise nullptr
+         */
+        agent* pondering_agent() const {
+            bool evil_next = step() < 9 || !(step() & 1);
+            agent& next = evil_next ? *evil : *play;
+            agent& other = evil_next ? *play : *evil;
+            return (next.role() == "dummy" && other.role() != "dummy") ? &other : nullptr;
+        }
         void open_episode(const std::string& tag) {
             play->open_episode(tag);
             evil->open_episode(tag);
@@ -59,7 +69,9 @@ public:
         if (it != ongoing.end()) {
             auto m = it->second;
             m->close_episode(tag);
-            dump << (*m) << std::endl << std::flush;
+            std::stringstream rec;
+            rec << (*m) << '\n';
+            dump.append(rec.str()); // written by the background writer
             ongoing.erase(it);
             return true;
         }
@@ -75,6 +87,17 @@ public:
     bool remove_agent(std::shared_ptr<agent> a) {
         return lounge.erase(a->name());
     }
+    /**
+     * put the agent in place of the one of the same name, which is retired and returned
+     * the ongoing matches keep playing with the old agent, and the new matches get the new one
+     */
+    std::shared_ptr<agent> replace_agent(std::shared_ptr<agent> a) {
+        std::shared_ptr<agent>& slot = lounge[a->name()];
+        std::shared_ptr<agent> old = slot;
+        if (old) old->retire();
+        slot = a;
+        return old;
+    }
 
 private:
     std::shared_ptr<agent> find_agent(const std::string& name, const std::string& role) {
@@ -115,14 +138,12 @@ public:
         auth = res;
     }
     void set_dump_file(const std::string& path) {
-        if (dump.is_open()) dump.close();
-        dump.clear();
-        dump.open(path, std::ios::out | std::ios::app);
+        dump.open(path);
     }
 
 private:
     std::unordered_map<std::string, std::shared_ptr<agent>> lounge;
     std::unordered_map<std::string, std::shared_ptr<match>> ongoing;
     std::string name, auth;
-    std::ofstream dump;
+    dump_writer dump;
 };
@@ -0,0 +1,97 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <string>
+#include <chrono>
+#include "board.h"
+#include "action.h"
+#include "agent.h"
+#include "episode.h"
+
+/**
+ * lockstep simulator of many independent games, e.g., for evaluation and data generation
+ *
+ * each of the 'lanes' games takes one move per round: the player's moves of all the lanes are searched
+ * by one take_actions, then the environment's (except the openings, which are random, and are taken by
+ * the lane's own copy of the environment seeded per game); with depth=1, the candidates of all the lanes are
+ * slid and evaluated together (see weight_agent::slide_all), and the games are the same as those played
+ * one by one by take_action with the same seeds
+ *
+ * a lane is refilled with a new game as soon as its game ends, and the time of a round is shared by its moves
+ */
+class lockstep {
+public:
+    lockstep(TDL_player& play, rndenv& evil, size_t lanes = 16) : play(play), evil(evil), lanes(std::max<size_t>(lanes, 1)) {}
+
+    /**
+     * play until next(seed) returns false and all the games have ended, where next(seed) gives the seed
+     * of a new game, and done(game, seed) is called with each finished game
+     */
+    template<typename next_t, typename done_t>
+    void run(next_t next, done_t done) {
+        std::vector<lane> games(lanes);
+        for (lane& g : games) g.evil = std::make_shared<rndenv>(evil, "");
+        auto refill = [&](lane& g) {
+            g.active = next(g.seed);
+            if (!g.active) return;
+            g.evil->seed(g.seed);
+            g.game = episode();
+            play.open_episode("~:" + evil.name());
+            g.evil->open_episode(play.name() + ":~");
+            g.game.open_episode(play.name() + ":" + evil.name());
+        };
+        for (lane& g : games) refill(g);
+
+        std::vector<size_t> who[2]; // the lanes in which the player (0) or the environment (1) moves
+        std::vector<board> states;
+        std::vector<action> moves(lanes);
+        for (bool active = true; active; ) {
+            who[0].clear();
+            who[1].clear();
+            for (size_t i = 0; i < lanes; i++) {
+                if (!games[i].active) continue;
+                size_t step = games[i].game.step();
+                who[(step < 9 || !(step & 1)) ? 1 : 0].push_back(i);
+            }
+
+            for (int side = 0; side < 2; side++) {
+                if (who[side].empty()) continue;
+                auto start = std::chrono::steady_clock::now();
+                states.clear();
+                for (size_t i : who[side]) states.push_back(games[i].game.state());
+                if (side == 0) {
+                    play.take_actions(states.data(), states.size(), moves.data());
+                } else {
+                    evil.take_actions(states.data(), states.size(), moves.data(), [&](size_t k) -> agent& { return *games[who[side][k]].evil; });
+                }
+                time_t share = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count() / who[side].size();
+
+                for (size_t k = 0; k < who[side].size(); k++) {
+                    lane& g = games[who[side][k]];
+                    if (g.game.apply_action(moves[k], std::max<time_t>(share, 1))) continue;
+                    agent& win = g.game.last_turns(play, *g.evil);
+                    g.game.close_episode(win.name());
+                    play.close_episode(win.name());
+                    g.evil->close_episode(win.name());
+                    done(g.game, g.seed);
+                    refill(g);
+                }
+            }
+
+            active = false;
+            for (lane& g : games) active |= g.active;
+        }
+    }
+
+private:
+    struct lane {
+        episode game;
+        std::shared_ptr<rndenv> evil; // for the openings, seeded per game
+        unsigned seed;
+        bool active;
+    };
+
+    TDL_player& play;
+    rndenv& evil;
+    size_t lanes;
+};
@@ -5,6 +5,7 @@
 #include <cmath>
 #include <random>
 #include <vector>
+#include <algorithm>
 
 /**
  * array-based board for Threes
@@ -25,8 +26,8 @@ public:
     typedef int reward;
 
 public:
-    board() : tile(), attr(1), last_op(-1), max_tile(3), next_tile(1), tile_counter(12), bag({1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3}) {}
-    board(const grid& b, data v = 0) : tile(b), attr(v) {}
+    board() : tile(), attr(1), last_op(-1), max_tile(3), next_tile(1), tile_counter(12), bag({{0, 4, 4, 4}}) {}
+    board(const grid& b, data v = 0) : tile(b), attr(v), bag() {}
     board(const board& b) = default;
     board& operator =(const board& b) = default;
 
@@ -47,8 +48,13 @@ public:
     int get_max_tile() const { return max_tile; }
     int get_tile_counter() { return tile_counter; }
     int get_tile_counter() const { return tile_counter; }
-    std::vector<cell> get_bag() { return bag; }
-    std::vector<cell> get_bag() const { return bag; }
+    std::vector<cell> get_bag() const {
+        std::vector<cell> res;
+        for (cell t = 1; t < 4; t++) res.insert(res.end(), bag[t], t);
+        return res;
+    }
+    int get_bag_count(const cell& t) const { return t < 4 ? bag[t] : 0; }
+    int get_bag_size() const { return bag[1] + bag[2] + bag[3]; }
 
 public:
     bool operator ==(const board& b) const { return tile == b.tile; }
@@ -83,9 +89,8 @@ public:
     void remove_tile(const cell& t) {
         if (t >= 4) return;
 
-        std::vector<cell>::iterator vi = find(bag.begin(), bag.end(), t);
-        if (vi != bag.end())
-            bag.erase(vi);
+        if (bag[t])
+            bag[t]--;
         else
             std::cout << "bag : cannot find the tile which will be removed." << std::endl;
 
@@ -93,8 +98,8 @@ public:
     }
 
     void check_bag() {
-        if (bag.empty())
-            bag = {1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3};
+        if (get_bag_size() == 0)
+            bag = {{0, 4, 4, 4}};
     }
 
     void set_next_tile(const cell& hint) {
@@ -228,7 +233,5 @@ private:
     cell max_tile;
     cell next_tile;
     int tile_counter;
-    std::vector<cell> bag;
-    std::default_random_engine random_engine;
-    std::uniform_int_distribution<int> random_generator;
+    std::array<uint8_t, 4> bag; // the number of 1-, 2-, and 3-tiles left in the bag, so that a board is trivially copyable
 };
@@ -0,0 +1,176 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <atomic>
+#include <cstring>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "board.h"
+#include "weight.h"
+
+/**
+ * persistent cache of search values, as a memory-mapped open-addressing hash table
+ *
+ * an entry is keyed by the 64-bit hash of the position (tiles, next tile, bag, last op, tile counter),
+ * the search level and depth, and the hash of the weights which produced the value; hence values computed by
+ * other weights are never hit, they are simply overwritten, and the file can be shared by runs
+ *
+ * the file consists of a header (magic "TDLC", version, capacity) and 'capacity' entries of 16 bytes;
+ * a lookup probes at most 'probes' slots from the home slot, an insertion takes the first empty or
+ * matching slot, otherwise it replaces the home slot
+ *
+ * the mapping is shared, so the entries reach the file without an explicit save; entries may be
+ * written by several threads at once, a torn entry fails its check and is treated as a miss
+ * the hits and misses are counted (relaxed) for the report
+ */
+class eval_cache {
+public:
+    static constexpr uint32_t magic = 0x434c4454; // "TDLC"
+    static constexpr uint32_t version = 2;
+    static constexpr size_t probes = 8;
+
+    struct entry {
+        uint64_t key;
+        float value;
+        uint32_t check;
+    };
+
+public:
+    /**
+     * open (or create) the cache file with a capacity of about 'mbytes' MB
+     * the file is recreated if its format or capacity does not match
+     */
+    eval_cache(const std::string& path, size_t mbytes, uint64_t weights) : weights(weights), base(nullptr), table(nullptr), mask(0), length(0), hits(0), misses(0) {
+        size_t capacity = 1;
+        while ((capacity << 1) * sizeof(entry) <= (mbytes << 20)) capacity <<= 1;
+        length = sizeof(header) + capacity * sizeof(entry);
+
+        int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd == -1) return;
+        struct stat st;
+        header head = {};
+        bool valid = ::fstat(fd, &st) == 0 && size_t(st.st_size) == length
+                  && ::pread(fd, &head, sizeof(head), 0) == sizeof(head)
+                  && head.magic == magic && head.version == version && head.capacity == capacity;
+        if (!valid) {
+            head = { magic, version, capacity };
+            if (::ftruncate(fd, 0) != 0 || ::ftruncate(fd, length) != 0
+                    || ::pwrite(fd, &head, sizeof(head), 0) != sizeof(head)) {
+                ::close(fd);
+                return;
+            }
+        }
+        void* map = ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (map == MAP_FAILED) return;
+        base = static_cast<char*>(map);
+        table = reinterpret_cast<entry*>(base + sizeof(header));
+        mask = capacity - 1;
+    }
+    eval_cache(const eval_cache&) = delete;
+    eval_cache& operator =(const eval_cache&) = delete;
+    ~eval_cache() {
+        if (base) ::munmap(base, length);
+    }
+
+    bool is_open() const { return base != nullptr; }
+    size_t capacity() const { return mask + 1; }
+    size_t hit_count() const { return hits.load(std::memory_order_relaxed); }
+    size_t miss_count() const { return misses.load(std::memory_order_relaxed); }
+
+public:
+    /**
+     * the key of the value of a board at a search level of a search with the given depth
+     */
+    uint64_t key(const board& b, int level, int depth) const {
+        uint64_t tiles = 0;
+        for (int i = 0; i < 16; i++) tiles = (tiles << 4) | (b(i) & 15);
+        uint64_t attr = uint64_t(b.get_next_tile() & 0xff)
+                      | uint64_t(b.get_bag_count(1)) << 8 | uint64_t(b.get_bag_count(2)) << 16 | uint64_t(b.get_bag_count(3)) << 24
+                      | uint64_t(b.get_last_op() & 0xff) << 32 | uint64_t(std::min(b.get_tile_counter(), 255)) << 40
+                      | uint64_t(b.get_max_tile() & 0xff) << 48 | uint64_t(level & 0x0f) << 56 | uint64_t(depth & 0x0f) << 60;
+        uint64_t k = mix(mix(tiles ^ weights) ^ attr);
+        return k ? k : 1; // 0 is reserved for empty slots
+    }
+
+    bool find(uint64_t k, float& value) {
+        for (size_t i = 0; i < probes; i++) {
+            entry e = table[(k + i) & mask];
+            if (e.key == 0) break;
+            if (e.key == k && e.check == check(e.key, e.value)) {
+                value = e.value;
+                hits.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        misses.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    void insert(uint64_t k, float value) {
+        entry* slot = &table[k & mask];
+        for (size_t i = 0; i < probes; i++) {
+            entry& e = table[(k + i) & mask];
+            if (e.key == 0 || e.key == k) {
+                slot = &e;
+                break;
+            }
+        }
+        *slot = { k, value, check(k, value) };
+    }
+
+public:
+    /**
+     * the hash of the weight tables, over the materialized pages and their positions
+     */
+    static uint64_t hash(const std::vector<weight>& net) {
+        uint64_t h = mix(net.size());
+        for (size_t t = 0; t < net.size(); t++) {
+            const weight& w = net[t];
+            h = mix(h ^ w.size());
+            for (size_t p = 0; p < w.pages(); p++) {
+                if (!w.is_materialized(p)) continue;
+                const float* page = w.page(p);
+                uint64_t v = mix(h ^ (t << 32) ^ p);
+                for (size_t i = 0; i < w.page_length(p); i++) {
+                    uint32_t bits;
+                    std::memcpy(&bits, page + i, sizeof(bits));
+                    v = (v ^ bits) * 0x100000001b3ull;
+                }
+                h = mix(h ^ v);
+            }
+        }
+        return h;
+    }
+
+private:
+    struct header {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t capacity;
+    };
+
+    static uint64_t mix(uint64_t x) {
+        x ^= x >> 30; x *= 0xbf58476d1ce4e5b9ull;
+        x ^= x >> 27; x *= 0x94d049bb133111ebull;
+        x ^= x >> 31;
+        return x;
+    }
+    static uint32_t check(uint64_t k, float value) {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        return uint32_t(mix(k ^ bits));
+    }
+
+private:
+    uint64_t weights;
+    char* base;
+    entry* table;
+    size_t mask;
+    size_t length;
+    std::atomic<size_t> hits;
+    std::atomic<size_t> misses;
+};
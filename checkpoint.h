@@ -0,0 +1,304 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <random>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "weight.h"
+#include "codec.h"
+
+/**
+ * incremental checkpoints of weight tables
+ *
+ * a checkpoint consists of a base file in the raw weight format (or the compressed one, see weight_codec), plus delta files
+ * "base.1", "base.2", ... holding only the pages changed since the previous checkpoint; deltas are written only
+ * if enabled (see set_delta), otherwise every save writes a full base, so the base file alone is always current
+ *
+ * a base ends with a trailer: a random 64-bit id and the magic "TDLI", which the readers of both formats ignore
+ *
+ * the delta format is
+ *  header: magic "TDLD", page size, stamp of the base file (size and id)
+ *  records: table (uint32), page (uint32), then the values of the page
+ *  terminated by a table of -1u
+ *
+ * the stamp ties a delta to its base, so leftover deltas of an older base are ignored, while a copy of the base
+ * keeps its deltas; a base without a trailer (written by an older version) gets a full base before any delta
+ * all files are written to a temporary file and renamed, so a partial file is never loaded
+ *
+ * an asynchronous save forks a copy-on-write snapshot of the process which writes the files,
+ * while the parent clears the dirty flags and continues immediately; the dirty flags are
+ * restored if the snapshot fails. at most one snapshot is in flight.
+ * the deltas are compacted into a new base once there are 'compact' of them.
+ */
+class checkpoint {
+public:
+    struct stamp {
+        uint64_t size;
+        uint64_t id; // 0 if the base has no trailer
+        bool operator ==(const stamp& s) const { return size == s.size && id == s.id; }
+        bool operator !=(const stamp& s) const { return !(*this == s); }
+    };
+
+public:
+    checkpoint(size_t compact = 16) : base_stamp({ 0, 0 }), seq(0), compact(compact), precision(0), delta(false), child(-1), target(nullptr), inflight_full(false) {}
+    checkpoint(const checkpoint&) = delete;
+    checkpoint& operator =(const checkpoint&) = delete;
+    ~checkpoint() { wait(); }
+
+    void set_compact(size_t n) { compact = n; }
+
+    /**
+     * save only the changed pages as a delta when saving to the current base
+     */
+    void set_delta(bool on) { delta = on; }
+
+    /**
+     * write the base files compressed with the given precision (1 ... 32), or raw if 0
+     */
+    void set_precision(unsigned bits) { precision = bits; }
+
+    /**
+     * take over the base and its deltas which have been loaded elsewhere
+     */
+    void adopt(const std::string& path, size_t deltas) {
+        wait();
+        base = path;
+        base_stamp = stamp_of(path);
+        seq = deltas;
+    }
+    size_t deltas() const { return seq; }
+
+    /**
+     * load the base (raw or compressed) and its deltas, return false if the base cannot be opened or is corrupted
+     */
+    bool load(const std::string& path, std::vector<weight>& net) {
+        std::ifstream in(path, std::ios::in | std::ios::binary);
+        if (!in.is_open()) return false;
+        uint32_t size;
+        if (!in.read(reinterpret_cast<char*>(&size), sizeof(size))) return false;
+        if (size == weight_codec::magic) {
+            if (!weight_codec::read(in, net)) return false;
+        } else {
+            if (size > 65536) return false;
+            net.resize(size);
+            for (weight& w : net) in >> w;
+            if (!in) return false; // the file ended early
+        }
+        in.close();
+        seq = apply_deltas(path, net);
+        base = path;
+        base_stamp = stamp_of(path);
+        return true;
+    }
+
+    /**
+     * save the tables to path, as a delta if enabled and path is the current base, otherwise as a new base
+     */
+    bool save(const std::string& path, std::vector<weight>& net, bool async = false) {
+        wait();
+        bool full = (!delta || path != base || base_stamp.id == 0 || seq >= compact);
+        if (!full && !is_dirty(net)) return true;
+        if (async) {
+            std::vector<std::vector<uint8_t>> dirty;
+            for (weight& w : net) dirty.push_back(w.dirty_pages());
+            pid_t pid = ::fork();
+            if (pid == 0) {
+                // the child of a multithreaded process must not create threads, so it encodes serially
+                bool ok = full ? write_base(path, net, precision, true) : write_delta(path, seq + 1, base_stamp, net);
+                ::_exit(ok ? 0 : 1);
+            } else if (pid > 0) {
+                for (weight& w : net) w.mark_clean();
+                child = pid;
+                target = &net;
+                pending = path;
+                inflight.swap(dirty);
+                inflight_full = full;
+                return true;
+            }
+        }
+        bool ok = full ? write_base(path, net, precision) : write_delta(path, seq + 1, base_stamp, net);
+        if (ok) {
+            for (weight& w : net) w.mark_clean();
+            commit(path, full);
+        }
+        return ok;
+    }
+
+    /**
+     * wait for the snapshot in flight, return false if it has failed
+     */
+    bool wait() {
+        if (child == -1) return true;
+        int status = 0;
+        bool ok = ::waitpid(child, &status, 0) == child && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        child = -1;
+        if (ok) {
+            commit(pending, inflight_full);
+        } else {
+            for (size_t t = 0; t < inflight.size() && t < target->size(); t++) {
+                for (size_t p = 0; p < inflight[t].size(); p++)
+                    if (inflight[t][p]) (*target)[t].mark_dirty(p);
+            }
+        }
+        inflight.clear();
+        return ok;
+    }
+
+public:
+    /**
+     * the size and the id of a base file, or zeros if it does not exist
+     */
+    static stamp stamp_of(const std::string& path) {
+        std::ifstream in(path, std::ios::in | std::ios::binary | std::ios::ate);
+        if (!in.is_open()) return { 0, 0 };
+        uint64_t size = in.tellg();
+        trailer tail = {};
+        if (size >= sizeof(tail) && !in.seekg(size - sizeof(tail)).read(reinterpret_cast<char*>(&tail), sizeof(tail))) return { size, 0 };
+        return { size, tail.magic == trailer_magic ? tail.id : 0 };
+    }
+
+    /**
+     * the identity of a base and its deltas, i.e., the canonical path, the device and inode,
+     * and the sizes and mtimes of the files; any rewrite or new delta changes the identity
+     */
+    static std::string identity(const std::string& path) {
+        std::string id = path;
+        char* real = ::realpath(path.c_str(), nullptr);
+        if (real) id = real, std::free(real);
+        struct stat st;
+        if (::stat(path.c_str(), &st) == 0)
+            id += "@" + std::to_string(st.st_dev) + ":" + std::to_string(st.st_ino);
+        for (size_t seq = 0; ::stat((seq ? delta_path(path, seq) : path).c_str(), &st) == 0 && st.st_size; seq++) {
+            uint64_t mtime = uint64_t(st.st_mtim.tv_sec) * 1000000000ull + st.st_mtim.tv_nsec;
+            id += "|" + std::to_string(st.st_size) + ":" + std::to_string(mtime);
+        }
+        return id;
+    }
+
+    static std::string delta_path(const std::string& base, size_t seq) {
+        return base + "." + std::to_string(seq);
+    }
+
+    /**
+     * write the full tables as the new base, and discard the deltas of the old one
+     * the base is compressed with the given precision (serially if asked, see weight_codec::write), or is raw if precision is 0
+     */
+    static bool write_base(const std::string& path, std::vector<weight>& net, unsigned precision = 0, bool serial = false) {
+        std::string temp = path + ".tmp";
+        std::ofstream out(temp, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!out.is_open()) return false;
+        if (precision) {
+            weight_codec::write(out, net, precision, serial);
+        } else {
+            uint32_t size = net.size();
+            out.write(reinterpret_cast<char*>(&size), sizeof(size));
+            for (weight& w : net) out << w;
+        }
+        trailer tail = { uint64_t(std::random_device()()) << 32 | std::random_device()(), trailer_magic };
+        tail.id += !tail.id;
+        out.write(reinterpret_cast<const char*>(&tail), sizeof(tail));
+        out.close();
+        if (!out || std::rename(temp.c_str(), path.c_str()) != 0) return false;
+        for (size_t seq = 1; std::remove(delta_path(path, seq).c_str()) == 0; seq++);
+        for (weight& w : net) w.mark_clean();
+        return true;
+    }
+
+    /**
+     * write the dirty pages as the delta 'seq' of the base
+     * note that the dirty flags are not cleared here, since this may run in a forked snapshot
+     */
+    static bool write_delta(const std::string& path, size_t seq, const stamp& base, const std::vector<weight>& net) {
+        std::string file = delta_path(path, seq), temp = file + ".tmp";
+        std::ofstream out(temp, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!out.is_open()) return false;
+        uint32_t head[2] = { magic, uint32_t(weight::page_size) };
+        out.write(reinterpret_cast<const char*>(head), sizeof(head));
+        out.write(reinterpret_cast<const char*>(&base), sizeof(base));
+        for (uint32_t t = 0; t < net.size(); t++) {
+            for (uint32_t p = 0; p < net[t].pages(); p++) {
+                if (!net[t].is_dirty(p)) continue;
+                uint32_t rec[2] = { t, p };
+                out.write(reinterpret_cast<const char*>(rec), sizeof(rec));
+                out.write(reinterpret_cast<const char*>(net[t].page(p)), sizeof(float) * net[t].page_length(p));
+            }
+        }
+        uint32_t end[2] = { -1u, -1u };
+        out.write(reinterpret_cast<const char*>(end), sizeof(end));
+        out.close();
+        return out && std::rename(temp.c_str(), file.c_str()) == 0;
+    }
+
+    /**
+     * apply the deltas of the base in sequence, return the number of deltas applied
+     */
+    static size_t apply_deltas(const std::string& path, std::vector<weight>& net) {
+        stamp base = stamp_of(path);
+        size_t seq = 1;
+        for (; apply_delta(delta_path(path, seq), base, net); seq++);
+        for (weight& w : net) w.mark_clean();
+        return seq - 1;
+    }
+
+private:
+    void commit(const std::string& path, bool full) {
+        if (full) {
+            base = path;
+            base_stamp = stamp_of(path);
+            seq = 0;
+        } else {
+            seq++;
+        }
+    }
+
+    static bool is_dirty(const std::vector<weight>& net) {
+        for (const weight& w : net) {
+            for (size_t p = 0; p < w.pages(); p++)
+                if (w.is_dirty(p)) return true;
+        }
+        return false;
+    }
+
+    static bool apply_delta(const std::string& file, const stamp& base, std::vector<weight>& net) {
+        std::ifstream in(file, std::ios::in | std::ios::binary);
+        if (!in.is_open()) return false;
+        uint32_t head[2];
+        stamp st;
+        in.read(reinterpret_cast<char*>(head), sizeof(head));
+        in.read(reinterpret_cast<char*>(&st), sizeof(st));
+        if (!in || head[0] != magic || head[1] != weight::page_size || st != base) return false;
+        for (uint32_t rec[2]; in.read(reinterpret_cast<char*>(rec), sizeof(rec)) && rec[0] != -1u; ) {
+            if (rec[0] >= net.size() || rec[1] >= net[rec[0]].pages()) return false;
+            weight& w = net[rec[0]];
+            in.read(reinterpret_cast<char*>(w.page(rec[1])), sizeof(float) * w.page_length(rec[1]));
+        }
+        return bool(in);
+    }
+
+    static constexpr uint32_t magic = 0x444c4454; // "TDLD"
+    static constexpr uint32_t trailer_magic = 0x494c4454; // "TDLI"
+
+    struct trailer {
+        uint64_t id;
+        uint32_t magic;
+        uint32_t reserved;
+    };
+
+private:
+    std::string base;
+    stamp base_stamp;
+    size_t seq;
+    size_t compact;
+    unsigned precision;
+    bool delta;
+    pid_t child;
+    std::string pending;
+    std::vector<weight>* target;
+    std::vector<std::vector<uint8_t>> inflight;
+    bool inflight_full;
+};
@@ -0,0 +1,228 @@
+#pragma once
+#include <iostream>
+#include <string>
+#include <vector>
+#include <array>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include "weight.h"
+
+/**
+ * compressed container of weight tables
+ *
+ * the format is
+ *  header: magic "TDLZ", version, number of tables, precision (the bits kept of each float)
+ *  directory: for each table, its length, the size of its encoded block, and the checksum of the block
+ *  index checksum: the checksum of the header and the directory (since version 2)
+ *  blocks: the encoded tables in order
+ *
+ * a table is encoded as a sequence of runs, each starts with a varint token
+ *  (n << 1):     n zero entries
+ *  (n << 1) | 1: n nonzero entries, each as the zigzag varint of the difference to the previous nonzero one
+ * where an entry is the float with only its leading 'precision' bits kept (rounded to nearest),
+ * so precision 32 is lossless, and 16 keeps the sign, exponent, and 7 bits of the mantissa
+ *
+ * the directory is checked before anything is allocated: a table may not be longer than the key range,
+ * and the blocks may not be larger than the rest of the file; version 1 files (without the index checksum)
+ * are still read with these checks
+ *
+ * the tables are encoded and decoded by several threads (except in a forked snapshot), the magic never equals the number of tables
+ * of the raw format, so both formats can be told apart by the first word
+ */
+class weight_codec {
+public:
+    static constexpr uint32_t magic = 0x5a4c4454; // "TDLZ"
+    static constexpr uint32_t version = 2;
+    static constexpr uint64_t max_length = uint64_t(1) << 24; // the key range of a table, see param_socket
+
+public:
+    /**
+     * write the tables with the given precision (1 ... 32), return false on failure
+     * the tables are encoded by all the hardware threads, or by the calling thread only if 'serial',
+     * e.g., in a forked child of a multithreaded process, where no thread may be created
+     */
+    static bool write(std::ostream& out, const std::vector<weight>& net, unsigned precision = 32, bool serial = false) {
+        precision = std::max(1u, std::min(32u, precision));
+        std::vector<std::string> block(net.size());
+        auto task = [&](size_t t) { encode(net[t], precision, block[t]); };
+        if (serial) {
+            for (size_t t = 0; t < net.size(); t++) task(t);
+        } else {
+            parallel(net.size(), task);
+        }
+
+        uint32_t head[4] = { magic, version, uint32_t(net.size()), precision };
+        std::string index(reinterpret_cast<const char*>(head), sizeof(head));
+        for (size_t t = 0; t < net.size(); t++) {
+            uint64_t dir[3] = { net[t].size(), block[t].size(), checksum(block[t]) };
+            index.append(reinterpret_cast<const char*>(dir), sizeof(dir));
+        }
+        uint64_t check = checksum(index);
+        out.write(index.data(), index.size());
+        out.write(reinterpret_cast<const char*>(&check), sizeof(check));
+        for (const std::string& b : block) out.write(b.data(), b.size());
+        return bool(out);
+    }
+
+    /**
+     * read the tables after the magic has been consumed, return false if the container is corrupted
+     */
+    static bool read(std::istream& in, std::vector<weight>& net) {
+        uint32_t head[4] = { magic };
+        if (!in.read(reinterpret_cast<char*>(head + 1), sizeof(uint32_t) * 3) || head[1] < 1 || head[1] > version) return false;
+        unsigned precision = head[3];
+        if (precision < 1 || precision > 32 || head[2] > 65536) return false;
+        std::string index(reinterpret_cast<const char*>(head), sizeof(head));
+        std::vector<std::array<uint64_t, 3>> dir(head[2]);
+        for (auto& d : dir) {
+            if (!in.read(reinterpret_cast<char*>(d.data()), sizeof(uint64_t) * 3)) return false;
+            index.append(reinterpret_cast<const char*>(d.data()), sizeof(uint64_t) * 3);
+        }
+        uint64_t check = 0;
+        if (head[1] >= 2 && (!in.read(reinterpret_cast<char*>(&check), sizeof(check)) || check != checksum(index))) return false;
+
+        uint64_t left = remaining(in);
+        for (auto& d : dir) {
+            if (d[0] > max_length || d[1] > left) return false;
+            left -= d[1];
+        }
+        std::vector<std::string> block(dir.size());
+        for (size_t t = 0; t < dir.size() && in; t++) {
+            block[t].resize(dir[t][1]);
+            in.read(&block[t][0], block[t].size());
+        }
+        if (!in) return false;
+
+        net.clear();
+        net.resize(dir.size());
+        std::atomic<bool> ok(true);
+        parallel(dir.size(), [&](size_t t) {
+            if (checksum(block[t]) != dir[t][2]) { ok = false; return; }
+            weight(dir[t][0]).swap(net[t]);
+            if (!decode(block[t], precision, net[t])) ok = false;
+        });
+        return ok;
+    }
+
+private:
+    static void encode(const weight& w, unsigned precision, std::string& out) {
+        std::vector<uint32_t> literal;
+        uint64_t zeros = 0;
+        uint32_t prev = 0;
+        auto flush = [&]() {
+            if (literal.empty()) return;
+            put(out, (uint64_t(literal.size()) << 1) | 1);
+            for (uint32_t v : literal) put(out, zigzag(int32_t(v - prev))), prev = v;
+            literal.clear();
+        };
+        for (size_t p = 0; p < w.pages(); p++) {
+            if (!w.is_materialized(p)) {
+                flush();
+                zeros += w.page_length(p);
+                continue;
+            }
+            const float* page = w.page(p);
+            for (size_t i = 0; i < w.page_length(p); i++) {
+                uint32_t v = reduce(page[i], precision);
+                if (v == 0) {
+                    flush();
+                    zeros++;
+                } else {
+                    if (zeros) put(out, zeros << 1), zeros = 0;
+                    literal.push_back(v);
+                }
+            }
+        }
+        flush();
+        if (zeros) put(out, zeros << 1);
+    }
+
+    static bool decode(const std::string& in, unsigned precision, weight& w) {
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(in.data());
+        const uint8_t* end = p + in.size();
+        uint64_t i = 0;
+        uint32_t prev = 0;
+        while (p < end && i < w.size()) {
+            uint64_t token;
+            if (!get(p, end, token)) return false;
+            uint64_t n = token >> 1;
+            if (n > w.size() - i) return false;
+            if ((token & 1) == 0) {
+                i += n;
+                continue;
+            }
+            for (uint64_t k = 0; k < n; k++) {
+                uint64_t delta;
+                if (!get(p, end, delta)) return false;
+                prev += uint32_t(unzigzag(delta));
+                w[i++] = expand(prev, precision);
+            }
+        }
+        return p == end && i == w.size();
+    }
+
+    static uint32_t reduce(float f, unsigned precision) {
+        uint32_t bits;
+        std::memcpy(&bits, &f, sizeof(bits));
+        if (precision >= 32) return bits;
+        unsigned drop = 32 - precision;
+        uint64_t rounded = uint64_t(bits) + (uint64_t(1) << (drop - 1));
+        return uint32_t(std::min<uint64_t>(rounded, 0xffffffffull) >> drop);
+    }
+    static float expand(uint32_t v, unsigned precision) {
+        uint32_t bits = precision >= 32 ? v : v << (32 - precision);
+        float f;
+        std::memcpy(&f, &bits, sizeof(f));
+        return f;
+    }
+
+    static uint64_t zigzag(int32_t v) { return (uint32_t(v) << 1) ^ uint32_t(v >> 31); }
+    static int32_t unzigzag(uint64_t v) { return int32_t(uint32_t(v >> 1) ^ -uint32_t(v & 1)); }
+
+    static void put(std::string& out, uint64_t v) {
+        while (v >= 0x80) out.push_back(char(v | 0x80)), v >>= 7;
+        out.push_back(char(v));
+    }
+    static bool get(const uint8_t*& p, const uint8_t* end, uint64_t& v) {
+        v = 0;
+        for (unsigned shift = 0; p < end && shift < 64; shift += 7) {
+            uint8_t b = *p++;
+            v |= uint64_t(b & 0x7f) << shift;
+            if ((b & 0x80) == 0) return true;
+        }
+        return false;
+    }
+
+    /**
+     * the number of bytes from the current position to the end of the stream
+     */
+    static uint64_t remaining(std::istream& in) {
+        std::streampos pos = in.tellg();
+        if (pos == std::streampos(-1) || !in.seekg(0, std::ios::end)) return 0;
+        std::streampos end = in.tellg();
+        in.seekg(pos);
+        return end > pos ? uint64_t(end - pos) : 0;
+    }
+
+    static uint64_t checksum(const std::string& data) {
+        uint64_t h = 0xcbf29ce484222325ull;
+        for (unsigned char c : data) h = (h ^ c) * 0x100000001b3ull;
+        return h;
+    }
+
+    /**
+     * run task(0) ... task(n - 1) by all the hardware threads
+     */
+    template<typename task_t>
+    static void parallel(size_t n, task_t task) {
+        std::atomic<size_t> next(0);
+        std::vector<std::thread> workers;
+        size_t threads = std::min<size_t>(n, std::max(std::thread::hardware_concurrency(), 1u));
+        for (size_t i = 0; i < threads; i++)
+            workers.emplace_back([&]() { for (size_t t; (t = next++) < n; ) task(t); });
+        for (std::thread& worker : workers) worker.join();
+    }
+};
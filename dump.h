@@ -0,0 +1,124 @@
+#pragma once
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <fcntl.h>
+#include <unistd.h>
+
+/**
+ * asynchronous append-only writer of the dump file, with group commit
+ *
+ * records are appended to a queue in memory, and a background thread writes them in batches,
+ * each by a single write followed by a single fdatasync; a batch is committed once it reaches
+ * 'batch' bytes, or once its oldest record has waited for 'latency', whichever comes first
+ *
+ * the queue is drained when the file is closed (or switched), and on SIGINT/SIGTERM, after which
+ * the signal is raised again with its default action
+ */
+class dump_writer {
+public:
+    dump_writer(std::chrono::milliseconds latency = std::chrono::milliseconds(100), size_t batch = 1 << 16)
+        : fd(-1), latency(latency), batch(batch), stop(false) {}
+    dump_writer(const dump_writer&) = delete;
+    dump_writer& operator =(const dump_writer&) = delete;
+    ~dump_writer() { close(); }
+
+    bool open(const std::string& path) {
+        close();
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (fd == -1) return false;
+        stop = false;
+        watch_signals();
+        worker = std::thread(&dump_writer::run, this);
+        return true;
+    }
+    bool is_open() const { return fd != -1; }
+
+    /**
+     * drain the queue, and stop the background thread
+     */
+    void close() {
+        if (!worker.joinable()) return;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stop = true;
+        }
+        ready.notify_one();
+        worker.join();
+        ::close(fd);
+        fd = -1;
+    }
+
+    /**
+     * queue a record, never blocks on the file
+     */
+    void append(const std::string& rec) {
+        if (fd == -1) return;
+        bool notify;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (queue.empty()) oldest = clock::now();
+            queue += rec;
+            notify = queue.size() >= batch || queue.size() == rec.size();
+        }
+        if (notify) ready.notify_one();
+    }
+
+private:
+    typedef std::chrono::steady_clock clock;
+
+    void run() {
+        std::string buf;
+        std::unique_lock<std::mutex> guard(lock);
+        while (true) {
+            // wake up periodically to notice the signals
+            ready.wait_for(guard, latency, [&]() { return stop || queue.size() || signaled(); });
+            if (queue.size() && !stop && !signaled() && queue.size() < batch) {
+                ready.wait_until(guard, oldest + latency, [&]() { return stop || queue.size() >= batch || signaled(); });
+            }
+            buf.swap(queue);
+            bool quit = stop || signaled();
+            guard.unlock();
+            commit(buf);
+            buf.clear();
+            if (signaled()) {
+                std::signal(signaled(), SIG_DFL);
+                std::raise(signaled());
+            }
+            guard.lock();
+            if (quit && queue.empty()) break;
+        }
+    }
+
+    void commit(const std::string& buf) {
+        for (size_t off = 0; off < buf.size(); ) {
+            ssize_t n = ::write(fd, buf.data() + off, buf.size() - off);
+            if (n <= 0) return;
+            off += n;
+        }
+        if (buf.size()) ::fdatasync(fd);
+    }
+
+    static std::atomic<int>& signal_number() { static std::atomic<int> sig(0); return sig; }
+    static int signaled() { return signal_number().load(); }
+    static void on_signal(int sig) { signal_number() = sig; }
+    static void watch_signals() {
+        std::signal(SIGINT, on_signal);
+        std::signal(SIGTERM, on_signal);
+    }
+
+private:
+    int fd;
+    std::chrono::milliseconds latency;
+    size_t batch;
+    bool stop;
+    std::string queue;
+    clock::time_point oldest;
+    std::mutex lock;
+    std::condition_variable ready;
+    std::thread worker;
+};
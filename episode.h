@@ -9,6 +9,7 @@
 #include "board.h"
 #include "action.h"
 #include "agent.h"
+#include "histogram.h"
 
 class statistic;
 
@@ -31,12 +32,20 @@ public:
     bool apply_action(action move) {
         board::reward reward = move.apply(state());
         if (reward == -1) return false;
-        ep_moves.emplace_back(move, reward, millisec() - ep_time);
-        ep_score += reward;
+        record(move, reward, ep_time ? nanosec() - ep_time : 0); // a move applied without taking turns (e.g., of a remote opponent) is not timed
+        return true;
+    }
+    /**
+     * apply a move which took the given time (in nanoseconds), e.g., its share of a batch searched at once
+     */
+    bool apply_action(action move, time_t time) {
+        board::reward reward = move.apply(state());
+        if (reward == -1) return false;
+        record(move, reward, time);
         return true;
     }
     agent& take_turns(agent& play, agent& evil) {
-        ep_time = millisec();
+        ep_time = nanosec();
         if (step() < 9)
             return evil;
         else if (step() & 1)
@@ -49,46 +58,39 @@ public:
     }
 
 public:
+    /**
+     * the moves are attributed to the roles by their types, since the opening takes 9 placements
+     */
     size_t step(unsigned who = -1u) const {
-        int size = ep_moves.size(); // 'int' is important for handling 0
-        switch (who) {
-            case action::slide::type: return (size - 1) / 2;
-            case action::place::type: return (size - (size - 1) / 2);
-            default:                  return size;
-        }
+        if (who == -1u) return ep_moves.size();
+        return std::count_if(ep_moves.begin(), ep_moves.end(), [=](const move& m) { return m.code.type() == who; });
     }
 
+    /**
+     * the total thinking time (in nanoseconds) of the given role, or the duration of the whole episode
+     */
     time_t time(unsigned who = -1u) const {
+        if (who == -1u) return (ep_close.when - ep_open.when) * 1000000;
         time_t time = 0;
-        size_t i = 2;
-        switch (who) {
-        case action::place::type:
-            if (ep_moves.size()) time += ep_moves[0].time, i = 1;
-            // no break;
-        case action::slide::type:
-            while (i < ep_moves.size()) time += ep_moves[i].time, i += 2;
-            break;
-        default:
-            time = ep_close.when - ep_open.when;
-            break;
-        }
+        for (const move& m : ep_moves)
+            if (m.code.type() == who) time += m.time;
         return time;
     }
 
+    /**
+     * the per-move latencies of the given role, moves which were not timed are excluded
+     */
+    histogram latency(unsigned who) const {
+        histogram h;
+        for (const move& m : ep_moves)
+            if (m.code.type() == who && m.time) h.add(m.time);
+        return h;
+    }
+
     std::vector<action> actions(unsigned who = -1u) const {
         std::vector<action> res;
-        size_t i = 2;
-        switch (who) {
-        case action::place::type:
-            if (ep_moves.size()) res.push_back(ep_moves[0]), i = 1;
-            // no break;
-        case action::slide::type:
-            while (i < ep_moves.size()) res.push_back(ep_moves[i]), i += 2;
-            break;
-        default:
-            res.assign(ep_moves.begin(), ep_moves.end());
-            break;
-        }
+        for (const move& m : ep_moves)
+            if (who == -1u || m.code.type() == who) res.push_back(m);
         return res;
     }
 
@@ -118,6 +120,9 @@ public:
 
 protected:
 
+    /**
+     * the time of a move is kept in nanoseconds, but is recorded in milliseconds for compatibility
+     */
     struct move {
         action code;
         board::reward reward;
@@ -128,7 +133,7 @@ protected:
         friend std::ostream& operator <<(std::ostream& out, const move& m) {
             out << m.code;
             if (m.reward) out << '[' << std::dec << m.reward << ']';
-            if (m.time) out << '(' << std::dec << m.time << ')';
+            if (m.time >= 1000000) out << '(' << std::dec << (m.time / 1000000) << ')';
             return out;
         }
         friend std::istream& operator >>(std::istream& in, move& m) {
@@ -144,6 +149,7 @@ protected:
                 in.ignore(1);
                 in >> std::dec >> m.time;
                 in.ignore(1);
+                m.time *= 1000000;
             }
             return in;
         }
@@ -162,6 +168,12 @@ protected:
         }
     };
 
+    void record(action move, board::reward reward, time_t time) {
+        ep_moves.emplace_back(move, reward, time);
+        ep_time = 0;
+        ep_score += reward;
+    }
+
     static board initial_state() {
         return {};
     }
@@ -169,6 +181,10 @@ protected:
         auto now = std::chrono::system_clock::now().time_since_epoch();
         return std::chrono::duration_cast<std::chrono::milliseconds>(now).count();
     }
+    static time_t nanosec() {
+        auto now = std::chrono::steady_clock::now().time_since_epoch();
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+    }
 
 private:
     board ep_state;
@@ -0,0 +1,104 @@
+#pragma once
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <algorithm>
+#include <numeric>
+#include <cstdint>
+#include "weight.h"
+
+/**
+ * sampled access heatmap of weight tables, per table and per page
+ *
+ * reads are sampled per evaluation (all the lookups of one board out of every 'period' on average),
+ * writes are sampled per update, both by a thread-local xorshift generator, so the overhead of
+ * an unsampled access is a few instructions; the counters are relaxed atomics shared by all the
+ * agents (and threads) of the same tables, and the counts reported are the sampled ones
+ *
+ * the report consists of
+ *  a line per table: its occupancy, the pages touched, the sampled reads and writes, and the access skew,
+ *                    i.e., the share of the accesses to its hottest 1% and 10% of pages
+ *  the hottest pages over all tables
+ */
+class access_heatmap {
+public:
+    access_heatmap(const std::vector<weight>& net, unsigned period = 64) : mask(1), offset(net.size() + 1, 0) {
+        while (mask < period) mask <<= 1;
+        mask -= 1;
+        for (size_t t = 0; t < net.size(); t++) offset[t + 1] = offset[t] + net[t].pages();
+        reads.reset(new std::atomic<uint32_t>[offset.back()]);
+        writes.reset(new std::atomic<uint32_t>[offset.back()]);
+        for (size_t p = 0; p < offset.back(); p++) reads[p] = 0, writes[p] = 0;
+    }
+
+    /**
+     * whether to record the current access (or evaluation), with probability 1/period
+     */
+    bool sample() const {
+        thread_local uint32_t x = 2463534242u ^ uint32_t(reinterpret_cast<uintptr_t>(&x));
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        return (x & mask) == 0;
+    }
+
+    void read(size_t table, size_t index) {
+        reads[offset[table] + (index >> weight::page_bits)].fetch_add(1, std::memory_order_relaxed);
+    }
+    void write(size_t table, size_t index) {
+        writes[offset[table] + (index >> weight::page_bits)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * show the report of the tables, with the 'hot' hottest pages
+     */
+    void report(std::ostream& out, const std::vector<weight>& net, size_t hot = 16) const {
+        std::ios ff(nullptr);
+        ff.copyfmt(out);
+        out << std::fixed << std::setprecision(1);
+        out << "heatmap: 1/" << (mask + 1) << " sampled" << std::endl;
+        out << "table" "\t" "used" "\t" "touched" "\t" "reads" "\t" "writes" "\t" "top1%" "\t" "top10%" << std::endl;
+        std::vector<std::pair<uint64_t, size_t>> hottest; // (accesses, global page)
+        for (size_t t = 0; t + 1 < offset.size() && t < net.size(); t++) {
+            size_t pages = offset[t + 1] - offset[t];
+            std::vector<uint64_t> count(pages);
+            uint64_t r = 0, w = 0;
+            size_t touched = 0;
+            for (size_t p = 0; p < pages; p++) {
+                uint64_t cr = reads[offset[t] + p], cw = writes[offset[t] + p];
+                count[p] = cr + cw;
+                r += cr, w += cw;
+                touched += (count[p] != 0);
+                if (count[p]) hottest.emplace_back(count[p], offset[t] + p);
+            }
+            std::sort(count.begin(), count.end(), std::greater<uint64_t>());
+            uint64_t total = std::max<uint64_t>(r + w, 1);
+            size_t top1 = std::max<size_t>(pages / 100, 1), top10 = std::max<size_t>(pages / 10, 1);
+            out << t << "\t" << (net[t].materialized() * 100.0 / std::max<size_t>(pages, 1)) << "%";
+            out << "\t" << (touched * 100.0 / std::max<size_t>(pages, 1)) << "%";
+            out << "\t" << r << "\t" << w;
+            out << "\t" << (std::accumulate(count.begin(), count.begin() + top1, uint64_t(0)) * 100.0 / total) << "%";
+            out << "\t" << (std::accumulate(count.begin(), count.begin() + top10, uint64_t(0)) * 100.0 / total) << "%";
+            out << std::endl;
+        }
+
+        hot = std::min(hot, hottest.size());
+        std::partial_sort(hottest.begin(), hottest.begin() + hot, hottest.end(), std::greater<std::pair<uint64_t, size_t>>());
+        out << "hot pages:";
+        for (size_t i = 0; i < hot; i++) {
+            size_t t = std::upper_bound(offset.begin(), offset.end(), hottest[i].second) - offset.begin() - 1;
+            size_t p = hottest[i].second - offset[t];
+            out << " " << t << ":" << p << "(" << reads[hottest[i].second] << "r" << writes[hottest[i].second] << "w)";
+        }
+        out << std::endl;
+        out.copyfmt(ff);
+    }
+
+private:
+    uint32_t mask;
+    std::vector<size_t> offset; // the first page of each table
+    std::unique_ptr<std::atomic<uint32_t>[]> reads;
+    std::unique_ptr<std::atomic<uint32_t>[]> writes;
+};
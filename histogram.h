@@ -0,0 +1,112 @@
+#pragma once
+#include <array>
+#include <string>
+#include <sstream>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <cstdint>
+
+/**
+ * log-bucketed latency histogram in nanoseconds
+ *
+ * each power of two is split into 'sub' linear buckets, so the relative error of a percentile
+ * is at most 1/sub; the maximum is kept exactly
+ */
+class histogram {
+public:
+    static constexpr int sub_bits = 3;
+    static constexpr int sub = 1 << sub_bits;
+    static constexpr int num_buckets = 64 * sub;
+
+public:
+    histogram() : bucket(), num(0), sum(0), peak(0) {}
+
+    void add(uint64_t ns, uint64_t n = 1) {
+        bucket[index(ns)] += n;
+        num += n;
+        sum += ns * n;
+        peak = std::max(peak, ns);
+    }
+    histogram& operator +=(const histogram& h) {
+        for (int i = 0; i < num_buckets; i++) bucket[i] += h.bucket[i];
+        num += h.num;
+        sum += h.sum;
+        peak = std::max(peak, h.peak);
+        return *this;
+    }
+
+    uint64_t count() const { return num; }
+    uint64_t max() const { return peak; }
+    uint64_t mean() const { return num ? sum / num : 0; }
+
+    /**
+     * the upper bound of the bucket where the q-quantile (0 < q <= 1) lies, capped by the maximum
+     */
+    uint64_t percentile(double q) const {
+        if (num == 0) return 0;
+        uint64_t rank = std::max<uint64_t>(1, uint64_t(q * num + 0.5)), seen = 0;
+        for (int i = 0; i < num_buckets; i++) {
+            seen += bucket[i];
+            if (seen >= rank) return std::min(upper(i), peak);
+        }
+        return peak;
+    }
+
+    /**
+     * e.g. "p50 = 120us, p90 = 310us, p99 = 1.2ms, max = 4.8ms"
+     */
+    std::string summary() const {
+        std::stringstream ss;
+        ss << "p50 = " << format(percentile(0.50)) << ", ";
+        ss << "p90 = " << format(percentile(0.90)) << ", ";
+        ss << "p99 = " << format(percentile(0.99)) << ", ";
+        ss << "max = " << format(max());
+        return ss.str();
+    }
+
+    static std::string format(uint64_t ns) {
+        std::stringstream ss;
+        ss << std::setprecision(3);
+        if (ns < 1000) ss << ns << "ns";
+        else if (ns < 1000000) ss << (ns / 1e3) << "us";
+        else if (ns < 1000000000) ss << (ns / 1e6) << "ms";
+        else ss << (ns / 1e9) << "s";
+        return ss.str();
+    }
+
+public:
+    /**
+     * the format is "count sum max" followed by the non-empty buckets as "index:count"
+     */
+    friend std::ostream& operator <<(std::ostream& out, const histogram& h) {
+        out << h.num << ' ' << h.sum << ' ' << h.peak;
+        for (int i = 0; i < num_buckets; i++)
+            if (h.bucket[i]) out << ' ' << i << ':' << h.bucket[i];
+        return out;
+    }
+    friend std::istream& operator >>(std::istream& in, histogram& h) {
+        h = {};
+        in >> h.num >> h.sum >> h.peak;
+        for (int i; in >> i && in.ignore(1) && i >= 0 && i < num_buckets; ) in >> h.bucket[i];
+        return in;
+    }
+
+private:
+    static int index(uint64_t ns) {
+        if (ns < sub) return int(ns);
+        int exp = 63 - __builtin_clzll(ns); // ns >= sub, so exp >= sub_bits
+        return std::min(num_buckets - 1, ((exp - sub_bits + 1) << sub_bits) + int((ns >> (exp - sub_bits)) & (sub - 1)));
+    }
+    static uint64_t upper(int i) {
+        if (i < sub) return i;
+        int exp = (i >> sub_bits) + sub_bits - 1;
+        return ((uint64_t(sub + (i & (sub - 1))) + 1) << (exp - sub_bits)) - 1;
+    }
+
+private:
+    std::array<uint64_t, num_buckets> bucket;
+    uint64_t num;
+    uint64_t sum;
+    uint64_t peak;
+};
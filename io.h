@@ -16,6 +16,7 @@ public:
         return *this;
     }
     input& operator =(const input&) = delete;
+    bool pending() const { return in.rdbuf()->in_avail() > 0; }
 private:
     std::istream& in;
 };
@@ -42,3 +43,148 @@ public:
     info& operator =(const info&) = delete;
 };
 
+
+/**
+ * reusable buffered writer
+ * messages are accumulated in a buffer which is kept across messages,
+ * and are written out only when flush() is called, e.g., once per input batch
+ */
+class writer : private std::streambuf, public std::ostream {
+public:
+    writer(std::ostream& out = std::cout, size_t capacity = 4096) : std::ostream(this), out(out) { buf.reserve(capacity); }
+    writer(const writer&) = delete;
+    writer& operator =(const writer&) = delete;
+    ~writer() { flush(); }
+
+    writer& flush() {
+        if (buf.size()) {
+            out.write(buf.data(), buf.size());
+            out.flush();
+            buf.clear();
+        }
+        return *this;
+    }
+    size_t size() const { return buf.size(); }
+
+private:
+    typedef std::streambuf::traits_type traits;
+    std::streambuf::int_type overflow(std::streambuf::int_type c) {
+        if (!traits::eq_int_type(c, traits::eof())) buf.push_back(traits::to_char_type(c));
+        return traits::not_eof(c);
+    }
+    std::streamsize xsputn(const char* s, std::streamsize n) {
+        buf.append(s, n);
+        return n;
+    }
+    int sync() { return 0; } // std::endl should not flush the underlying stream
+
+private:
+    std::ostream& out;
+    std::string buf;
+};
+
+/**
+ * allocation-free tokenizer for arena protocol messages
+ *
+ * the message classes are
+ *  move:       "#id move",     e.g. "#M0001 ?", "#M0001 #U", "#M0001 0C+2"
+ *  ctrl:       "#id ctrl tag", e.g. "#M0001 open Slider:Placer", "#M0001 close score=15424"
+ *  arena_ctrl: "@..." or "$...", e.g. "@ login", "@ error the account "Name" has already been taken"
+ *  arena_info: "?..." or "%...", e.g. "? message from anonymous: 2048!!!"
+ *
+ * tokens point into the original line, which should outlive the message
+ */
+class message {
+public:
+    enum kind { none, move, ctrl, arena_ctrl, arena_info };
+
+    struct token {
+        const char* ptr;
+        size_t len;
+        token(const char* ptr = "", size_t len = 0) : ptr(ptr), len(len) {}
+
+        const char* begin() const { return ptr; }
+        const char* end() const { return ptr + len; }
+        size_t size() const { return len; }
+        bool empty() const { return len == 0; }
+        char operator [](size_t i) const { return ptr[i]; }
+        std::string str() const { return std::string(ptr, len); }
+        std::string& str(std::string& res) const { return res.assign(ptr, len); }
+
+        bool operator ==(const char* s) const {
+            size_t i = 0;
+            for (; i < len && s[i]; i++) if (ptr[i] != s[i]) return false;
+            return i == len && s[i] == 0;
+        }
+        bool operator !=(const char* s) const { return !(*this == s); }
+        friend std::ostream& operator <<(std::ostream& out, const token& t) { return out.write(t.ptr, t.len); }
+    };
+
+public:
+    message(const std::string& line) : message(line.data(), line.size()) {}
+    message(const char* line, size_t len) : line(line, len), cls(none), num(0) { parse(); }
+
+    kind type() const { return cls; }
+    size_t size() const { return num; }
+    const token& operator [](size_t i) const { return tok[i]; }
+    const token& text() const { return line; }
+
+    /**
+     * the content after the leading "@", "$", "?" or "%" and spaces
+     */
+    token content() const {
+        const char* p = line.begin();
+        while (p != line.end() && (*p == '@' || *p == '$' || *p == ' ')) p++;
+        return token(p, line.end() - p);
+    }
+
+private:
+    void parse() {
+        if (line.empty()) return;
+        switch (line[0]) {
+        case '#': {
+            // tokens must be separated by exactly one space, same as "^#\\S+ \\S+$"
+            const char* p = line.begin();
+            const char* e = line.end();
+            for (;;) {
+                const char* q = p;
+                while (q != e && !is_space(*q)) q++;
+                if (q == p || num == 3) return reset();
+                tok[num++] = token(p, q - p);
+                if (q == e) break;
+                if (*q != ' ') return reset();
+                p = q + 1;
+            }
+            if (tok[0].size() < 2) return reset();
+            if (num == 2) cls = move;
+            if (num == 3) cls = ctrl;
+            break;
+        }
+        case '@':
+        case '$': {
+            if (line.size() < 2) return;
+            // the control word, e.g. "login" of "@ login"
+            const char* p = line.begin() + 1;
+            while (p != line.end() && is_space(*p)) p++;
+            const char* q = p;
+            while (q != line.end() && !is_space(*q)) q++;
+            tok[num++] = token(p, q - p);
+            cls = arena_ctrl;
+            break;
+        }
+        case '?':
+        case '%':
+            if (line.size() < 2) return;
+            cls = arena_info;
+            break;
+        }
+    }
+    void reset() { cls = none; num = 0; }
+    static bool is_space(char c) { return c == ' ' || c == '\t' || c == '\v' || c == '\f' || c == '\r' || c == '\n'; }
+
+private:
+    token line;
+    token tok[3];
+    kind cls;
+    size_t num;
+};
@@ -0,0 +1,342 @@
+#pragma once
+#include <array>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <iostream>
+#include <iomanip>
+#include <cstring>
+#include <cstdint>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/perf_event.h>
+
+/**
+ * hardware performance counter profiler, attributed to phases
+ *
+ * the counters (cycles, instructions, LLC misses, dTLB misses, and branch misses) are opened
+ * as a group by perf_event_open for each thread, and are read whenever the phase is switched,
+ * so each phase accumulates the events which occurred exclusively within it
+ * if perf_event_open (or some of the events) is unavailable, only the elapsed time is reported
+ *
+ * the counters are read by rdpmc from their mmap pages, which costs no system call; if the kernel does not
+ * allow rdpmc, a read costs a system call, so only the coarse phases (search, td-update, episode, i/o, and
+ * other) are switched, and the fine ones (slide/place, feature, lookup) are counted in their enclosing phase
+ *
+ * use profiler::scope to enter a phase, which restores the previous phase when leaving the scope
+ *
+ * the heap allocations can also be accounted to the phases, if the program replaces the global
+ * operator new and delete by ones which call allocated() and freed() (see threes.cpp); the number of
+ * allocations, the bytes (as the usable size of the blocks), the frees, and the peak of the heap while
+ * in each phase are counted by relaxed atomics, without the hardware counters
+ */
+class profiler {
+public:
+    enum phase { other, board_op, feature, lookup, search, update, bookkeeping, io, num_phases };
+    enum event { cycles, instructions, llc_misses, dtlb_misses, branch_misses, num_events };
+
+    class scope {
+    public:
+        scope(phase p) : switched(enabled() && local().admits(p)), prev(switched ? local().switch_to(p) : p), outer(tracking() ? heap_phase() : p) {
+            if (tracking()) heap_phase() = p;
+        }
+        scope(const scope&) = delete;
+        scope& operator =(const scope&) = delete;
+        ~scope() {
+            if (switched) local().switch_to(prev);
+            if (tracking()) heap_phase() = outer;
+        }
+    private:
+        bool switched;
+        phase prev;
+        phase outer;
+    };
+
+    /**
+     * the allocations so far, of all the phases
+     */
+    struct heap_usage {
+        uint64_t count, bytes;
+    };
+
+public:
+    /**
+     * enable the profiler, should be called before any worker thread starts
+     */
+    static void enable() { enabled() = true; }
+    static bool& enabled() { static bool flag = false; return flag; }
+
+    /**
+     * account the heap allocations to the phases, should be called before any worker thread starts
+     */
+    static void track_allocations() { tracking() = true; }
+    static bool& tracking() { static bool flag = false; return flag; }
+
+    static void allocated(size_t bytes) {
+        heap_t& h = heap();
+        phase p = heap_phase();
+        h.count[p].fetch_add(1, std::memory_order_relaxed);
+        h.bytes[p].fetch_add(bytes, std::memory_order_relaxed);
+        int64_t live = h.live.fetch_add(bytes, std::memory_order_relaxed) + int64_t(bytes);
+        int64_t peak = h.peak[p].load(std::memory_order_relaxed);
+        while (live > peak && !h.peak[p].compare_exchange_weak(peak, live, std::memory_order_relaxed));
+    }
+    static void freed(size_t bytes) {
+        heap_t& h = heap();
+        h.frees[heap_phase()].fetch_add(1, std::memory_order_relaxed);
+        h.live.fetch_sub(bytes, std::memory_order_relaxed);
+    }
+
+    static heap_usage allocations() {
+        heap_usage u = { 0, 0 };
+        for (int p = 0; p < num_phases; p++) {
+            u.count += heap().count[p].load(std::memory_order_relaxed);
+            u.bytes += heap().bytes[p].load(std::memory_order_relaxed);
+        }
+        return u;
+    }
+
+    static void report(std::ostream& out) {
+        if (tracking()) report_allocations(out);
+        if (!enabled()) return;
+        std::array<std::array<uint64_t, num_events + 1>, num_phases> sum = {};
+        std::array<uint64_t, num_phases> hits = {};
+        bool available[num_events] = {};
+        bool direct = true;
+        local().sample();
+        {
+            std::lock_guard<std::mutex> guard(registry().lock);
+            for (auto& c : registry().list) {
+                for (int p = 0; p < num_phases; p++) {
+                    for (int e = 0; e <= num_events; e++) sum[p][e] += c->total[p][e];
+                    hits[p] += c->hits[p];
+                }
+                for (int e = 0; e < num_events; e++) available[e] |= (c->index[e] != -1);
+                direct &= c->direct;
+            }
+        }
+
+        std::ios ff(nullptr);
+        ff.copyfmt(out);
+        out << "profile:" << std::endl;
+        out << std::left << std::setw(12) << "phase" << std::right;
+        out << std::setw(12) << "time(ms)" << std::setw(12) << "switches" << std::setw(16) << "cycles";
+        out << std::setw(16) << "instructions" << std::setw(8) << "IPC" << std::setw(14) << "LLC-misses";
+        out << std::setw(14) << "dTLB-misses" << std::setw(14) << "br-misses" << std::endl;
+        for (int p = 0; p < num_phases; p++) {
+            out << std::left << std::setw(12) << name(p) << std::right << std::fixed << std::setprecision(1);
+            out << std::setw(12) << (sum[p][num_events] / 1e6) << std::setw(12) << hits[p];
+            for (int e = 0; e < num_events; e++) {
+                if (e == llc_misses) {
+                    if (available[cycles] && available[instructions] && sum[p][cycles])
+                        out << std::setw(8) << std::setprecision(2) << (double(sum[p][instructions]) / sum[p][cycles]);
+                    else
+                        out << std::setw(8) << "n/a";
+                }
+                if (available[e])
+                    out << std::setw(e <= instructions ? 16 : 14) << sum[p][e];
+                else
+                    out << std::setw(e <= instructions ? 16 : 14) << "n/a";
+            }
+            out << std::endl;
+        }
+        if (!available[cycles]) out << "(hardware counters are unavailable, only the time is reported)" << std::endl;
+        else if (!direct) out << "(rdpmc is unavailable, slide/place, feature, and lookup are counted in their enclosing phases)" << std::endl;
+        out.copyfmt(ff);
+    }
+
+    static void report_allocations(std::ostream& out) {
+        heap_t& h = heap();
+        std::ios ff(nullptr);
+        ff.copyfmt(out);
+        out << "allocations:" << std::endl;
+        out << std::left << std::setw(12) << "phase" << std::right;
+        out << std::setw(14) << "allocs" << std::setw(16) << "bytes" << std::setw(14) << "frees" << std::setw(14) << "peak(KB)" << std::endl;
+        for (int p = 0; p < num_phases; p++) {
+            out << std::left << std::setw(12) << name(p) << std::right;
+            out << std::setw(14) << h.count[p].load() << std::setw(16) << h.bytes[p].load() << std::setw(14) << h.frees[p].load();
+            out << std::setw(14) << (h.peak[p].load() >> 10) << std::endl;
+        }
+        out.copyfmt(ff);
+    }
+
+private:
+    static const char* name(int p) {
+        const char* names[] = { "other", "slide/place", "feature", "lookup", "search", "td-update", "episode", "i/o" };
+        return names[p];
+    }
+
+    /**
+     * the phase to which the allocations of this thread are accounted
+     */
+    static phase& heap_phase() { thread_local phase p = other; return p; }
+
+    struct heap_t {
+        std::array<std::atomic<uint64_t>, num_phases> count, bytes, frees;
+        std::array<std::atomic<int64_t>, num_phases> peak; // the largest live heap seen while in the phase
+        std::atomic<int64_t> live; // the bytes allocated but not freed since the tracking started
+    };
+    static heap_t& heap() { static heap_t h; return h; }
+
+    struct counters {
+        std::array<int, num_events> fd;
+        std::array<int, num_events> index; // position of the event in a group read, or -1 if unavailable
+        std::array<perf_event_mmap_page*, num_events> page; // the mmap page of each event, for rdpmc
+        bool direct; // whether the counters can be read without a system call
+        std::array<uint64_t, num_events + 1> last; // the last reading, the time (ns) is the last one
+        std::array<std::array<uint64_t, num_events + 1>, num_phases> total;
+        std::array<uint64_t, num_phases> hits;
+        phase current;
+        int num;
+
+        counters() : direct(false), last(), total(), hits(), current(other), num(0) {
+            fd.fill(-1);
+            index.fill(-1);
+            page.fill(nullptr);
+            const uint64_t hw_cache = PERF_TYPE_HW_CACHE;
+            const uint64_t read_miss = (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            const uint64_t config[num_events][2] = {
+                { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+                { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+                { hw_cache, PERF_COUNT_HW_CACHE_LL | read_miss },
+                { hw_cache, PERF_COUNT_HW_CACHE_DTLB | read_miss },
+                { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+            };
+            for (int e = 0; e < num_events; e++) {
+                perf_event_attr attr;
+                std::memset(&attr, 0, sizeof(attr));
+                attr.size = sizeof(attr);
+                attr.type = config[e][0];
+                attr.config = config[e][1];
+                attr.exclude_kernel = 1;
+                attr.exclude_hv = 1;
+                attr.read_format = PERF_FORMAT_GROUP;
+                attr.disabled = (fd[cycles] == -1);
+                int leader = fd[cycles];
+                if (e != cycles && leader == -1) break; // no group without the leader
+                fd[e] = syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+                if (fd[e] != -1) index[e] = num++;
+            }
+            if (fd[cycles] != -1) ioctl_enable();
+            direct = map_pages();
+            read(last);
+        }
+        ~counters() {
+            for (perf_event_mmap_page* p : page) if (p) ::munmap(p, ::sysconf(_SC_PAGESIZE));
+            for (int f : fd) if (f != -1) ::close(f);
+        }
+
+        /**
+         * map the page of each event, return whether all the events can be read by rdpmc
+         */
+        bool map_pages() {
+#if defined(__x86_64__) || defined(__i386__)
+            bool ok = true;
+            for (int e = 0; e < num_events; e++) {
+                if (fd[e] == -1) continue;
+                void* map = ::mmap(nullptr, ::sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, fd[e], 0);
+                if (map == MAP_FAILED) return false;
+                page[e] = static_cast<perf_event_mmap_page*>(map);
+                ok &= page[e]->cap_user_rdpmc;
+            }
+            return ok;
+#else
+            return num == 0;
+#endif
+        }
+
+        /**
+         * whether the phase is switched, see the notes of the class
+         */
+        bool admits(phase p) const {
+            return direct || !(p == board_op || p == feature || p == lookup);
+        }
+
+#if defined(__x86_64__) || defined(__i386__)
+        static uint64_t rdpmc(uint32_t counter) {
+            uint32_t lo, hi;
+            __asm__ volatile("rdpmc" : "=a"(lo), "=d"(hi) : "c"(counter));
+            return lo | (uint64_t(hi) << 32);
+        }
+
+        /**
+         * read an event by its mmap page under the seqlock of the kernel, see perf_event_mmap_page
+         */
+        static uint64_t read_direct(const volatile perf_event_mmap_page* pc) {
+            uint32_t seq;
+            uint64_t count;
+            do {
+                seq = pc->lock;
+                std::atomic_signal_fence(std::memory_order_seq_cst);
+                count = pc->offset;
+                uint32_t idx = pc->index;
+                if (pc->cap_user_rdpmc && idx) {
+                    unsigned shift = 64 - pc->pmc_width;
+                    count += uint64_t(int64_t(rdpmc(idx - 1) << shift) >> shift);
+                }
+                std::atomic_signal_fence(std::memory_order_seq_cst);
+            } while (pc->lock != seq);
+            return count;
+        }
+#endif
+
+        void ioctl_enable() {
+            ::ioctl(fd[cycles], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ::ioctl(fd[cycles], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        }
+
+        void read(std::array<uint64_t, num_events + 1>& res) {
+#if defined(__x86_64__) || defined(__i386__)
+            if (num && direct) {
+                for (int e = 0; e < num_events; e++)
+                    if (page[e]) res[e] = read_direct(page[e]);
+            } else
+#endif
+            if (num) {
+                uint64_t buf[1 + num_events] = {};
+                if (::read(fd[cycles], buf, sizeof(uint64_t) * (1 + num)) > 0) {
+                    for (int e = 0; e < num_events; e++)
+                        if (index[e] != -1) res[e] = buf[1 + index[e]];
+                }
+            }
+            auto now = std::chrono::steady_clock::now().time_since_epoch();
+            res[num_events] = std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+        }
+
+        void sample() {
+            std::array<uint64_t, num_events + 1> now = last;
+            read(now);
+            for (int e = 0; e <= num_events; e++) total[current][e] += now[e] - last[e];
+            last = now;
+        }
+
+        phase switch_to(phase p) {
+            sample();
+            phase prev = current;
+            current = p;
+            hits[p]++;
+            return prev;
+        }
+    };
+
+    struct registry_t {
+        std::mutex lock;
+        std::vector<std::shared_ptr<counters>> list;
+    };
+    static registry_t& registry() { static registry_t reg; return reg; }
+
+    static counters& local() {
+        thread_local std::shared_ptr<counters> c;
+        if (!c) {
+            c = std::make_shared<counters>();
+            std::lock_guard<std::mutex> guard(registry().lock);
+            registry().list.push_back(c);
+        }
+        return *c;
+    }
+};
@@ -0,0 +1,166 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <stdexcept>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include "agent.h"
+#include "checkpoint.h"
+#include "io.h"
+
+/**
+ * hot reload of the agents of the shell, i.e., the agents are rebuilt with their weight files
+ * in the background, and are swapped in between the messages
+ *
+ * an agent is rebuilt when the identity of its load=... files (see checkpoint::identity) has changed,
+ * either when asked by the shell, or when found by polling the files every 'period' seconds, in which case
+ * the identity must have stayed the same for a period, so that a file being written is not loaded
+ *
+ * the swap is RCU-style: a new agent replaces the old one in the lounge, while the ongoing matches keep
+ * their old agent (and tables) until they are closed; the retired agents are released by the background
+ * thread once nothing else refers to them, so freeing the old tables never delays a reply
+ *
+ * the loading runs at a lower priority than the shell, and an agent which fails to load (a missing, truncated,
+ * or corrupted file, see weight_agent::load_failed, or any exception while building it) is not swapped in
+ */
+class reloader {
+public:
+    typedef std::function<std::shared_ptr<agent>()> factory;
+
+public:
+    reloader(double period = 0) : period(std::chrono::milliseconds(long(std::max(period, 0.0) * 1000))), checking(false), stop(false) {}
+    ~reloader() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stop = true;
+        }
+        wake.notify_one();
+        if (worker.joinable()) worker.join();
+    }
+
+    /**
+     * manage an agent which is rebuilt by 'make', if it loads its weights from a file
+     */
+    void manage(std::shared_ptr<agent> who, factory make) {
+        std::string path;
+        try {
+            path = who->property("load");
+        } catch (std::out_of_range&) {
+            return;
+        }
+        std::lock_guard<std::mutex> guard(lock);
+        entries.push_back({ who->name(), path, checkpoint::identity(path), std::string(), make });
+        if (!worker.joinable()) worker = std::thread(&reloader::run, this);
+    }
+
+    /**
+     * check the files now, e.g., by a control command
+     */
+    void request() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            checking = true;
+        }
+        wake.notify_one();
+    }
+
+    /**
+     * take the agents which are ready to be swapped in, and hand over the ones they replace
+     * 'swap' is given each new agent and returns the old one, which is released later
+     */
+    template<typename swap_t>
+    void adopt(swap_t swap) {
+        std::lock_guard<std::mutex> guard(lock);
+        for (auto& who : ready) retired.push_back(swap(who));
+        ready.clear();
+    }
+
+private:
+    struct entry {
+        std::string name;
+        std::string path;
+        std::string loaded; // the identity of the files of the current agent
+        std::string seen; // the identity found by the last poll
+        factory make;
+    };
+
+    void run() {
+        ::setpriority(PRIO_PROCESS, ::syscall(SYS_gettid), 10); // also inherited by the decoding threads
+        typedef std::chrono::steady_clock clock;
+        auto next = clock::now() + period;
+        std::unique_lock<std::mutex> guard(lock);
+        while (!stop) {
+            // poll at the given period, and release the retired agents every second
+            auto until = clock::now() + std::chrono::milliseconds(1000);
+            if (period.count() && (retired.empty() || next < until)) until = next;
+            wake.wait_until(guard, until, [this]() { return stop || checking; });
+            if (stop) break;
+            bool forced = checking;
+            bool polled = period.count() && clock::now() >= next;
+            checking = false;
+            if (polled) next = clock::now() + period;
+
+            for (size_t i = 0; i < retired.size(); ) {
+                if (retired[i].use_count() == 1) {
+                    std::shared_ptr<agent> old = std::move(retired[i]);
+                    retired.erase(retired.begin() + i);
+                    guard.unlock();
+                    old.reset();
+                    guard.lock();
+                } else {
+                    i++;
+                }
+            }
+            if (!forced && !polled) continue;
+
+            for (size_t i = 0; i < entries.size(); i++) {
+                entry& e = entries[i];
+                std::string id = checkpoint::identity(e.path);
+                bool stable = (id == e.seen);
+                e.seen = id;
+                if (id == e.loaded || !(forced || stable)) continue;
+
+                entry job = e; // the entry is not touched while unlocked
+                guard.unlock();
+                info() << "reload: loading " << job.name << " from " << job.path << std::endl;
+                auto start = std::chrono::steady_clock::now();
+                std::shared_ptr<agent> who;
+                try {
+                    who = job.make();
+                } catch (std::exception& e) {
+                    info() << "reload: " << job.name << ": " << e.what() << std::endl;
+                }
+                double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                weight_agent* loaded = dynamic_cast<weight_agent*>(who.get());
+                bool ok = who && !(loaded && loaded->load_failed());
+                guard.lock();
+
+                entries[i].loaded = id;
+                if (ok) {
+                    ready.push_back(who);
+                    info() << "reload: " << job.name << " is ready in " << sec << "s" << std::endl;
+                } else {
+                    info() << "reload: " << job.name << " failed to load, kept the current one" << std::endl;
+                }
+            }
+        }
+    }
+
+private:
+    std::chrono::milliseconds period;
+    std::vector<entry> entries;
+    std::vector<std::shared_ptr<agent>> ready; // to be swapped in by the shell
+    std::vector<std::shared_ptr<agent>> retired; // swapped out, but may still be playing
+    std::mutex lock;
+    std::condition_variable wake;
+    bool checking;
+    bool stop;
+    std::thread worker;
+};
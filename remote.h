@@ -0,0 +1,245 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <stdexcept>
+#include <iostream>
+#include <cstring>
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <poll.h>
+#include "weight.h"
+
+/**
+ * parameter server protocol over a local (unix domain) socket
+ *
+ * push: {'P', n} + n * {key, delta}, replied by {'V', n} + n * value
+ * pull: {'S', n} + {table, offset},  replied by {'V', n} + n * value
+ *
+ * where key = (table << 24) | index, note that 15^6 < 2^24
+ * a push applies the deltas and replies the refreshed values of the same entries,
+ * and a pull fetches a slice of a table
+ */
+class param_socket {
+public:
+    struct header {
+        uint32_t type;
+        uint32_t count;
+    };
+    struct entry {
+        uint32_t key;
+        float delta;
+    };
+    struct slice {
+        uint32_t table;
+        uint32_t offset;
+    };
+
+public:
+    param_socket(int fd = -1) : fd(fd), sent(0), recv(0) {}
+    param_socket(const param_socket&) = delete;
+    param_socket& operator =(const param_socket&) = delete;
+    virtual ~param_socket() { if (fd != -1) ::close(fd); }
+
+    size_t bytes_sent() const { return sent; }
+    size_t bytes_recv() const { return recv; }
+
+protected:
+    static sockaddr_un address(const std::string& path) {
+        sockaddr_un addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+        return addr;
+    }
+
+    bool write_all(int fd, const void* data, size_t size) {
+        const char* p = static_cast<const char*>(data);
+        while (size) {
+            ssize_t n = ::send(fd, p, size, MSG_NOSIGNAL);
+            if (n <= 0) return false;
+            p += n, size -= n, sent += n;
+        }
+        return true;
+    }
+    bool read_all(int fd, void* data, size_t size) {
+        char* p = static_cast<char*>(data);
+        while (size) {
+            ssize_t n = ::recv(fd, p, size, 0);
+            if (n <= 0) return false;
+            p += n, size -= n, recv += n;
+        }
+        return true;
+    }
+
+protected:
+    int fd;
+    size_t sent;
+    size_t recv;
+};
+
+/**
+ * the client side, which batches the sparse TD deltas of a training process
+ *
+ * the deltas of the same entry are accumulated locally, and are pushed every 'sync' episodes (and the rest at last);
+ * the refreshed values of the pushed entries and a rolling slice of 'slice' entries are written back
+ */
+class param_client : public param_socket {
+public:
+    param_client(const std::string& path, size_t sync = 1, size_t slice = 65536)
+            : sync(sync ? sync : 1), length(slice), episodes(0), table(0), offset(0) {
+        fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un addr = address(path);
+        if (fd == -1 || ::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0)
+            throw std::runtime_error("cannot connect to parameter server " + path);
+        deltas.reserve(1 << 16);
+    }
+
+    void record(uint32_t table, uint32_t index, float delta) {
+        deltas[(table << 24) | index] += delta;
+    }
+
+    bool pending() const { return deltas.size(); }
+
+    void close_episode(std::vector<weight>& net) {
+        if (++episodes % sync == 0) flush(net);
+    }
+
+    void flush(std::vector<weight>& net) {
+        if (deltas.size()) push(net);
+        if (length && net.size()) pull(net);
+    }
+
+private:
+    void push(std::vector<weight>& net) {
+        buffer.clear();
+        for (auto& d : deltas) buffer.push_back({ d.first, d.second });
+        deltas.clear();
+
+        header head = { 'P', uint32_t(buffer.size()) };
+        values.resize(buffer.size());
+        if (!write_all(fd, &head, sizeof(head)) || !write_all(fd, buffer.data(), sizeof(entry) * buffer.size())
+                || !read_all(fd, &head, sizeof(head)) || head.count != buffer.size()
+                || !read_all(fd, values.data(), sizeof(float) * values.size()))
+            throw std::runtime_error("parameter server disconnected");
+        for (size_t i = 0; i < buffer.size(); i++)
+            net[buffer[i].key >> 24][buffer[i].key & 0xffffff] = values[i];
+    }
+
+    void pull(std::vector<weight>& net) {
+        if (table >= net.size()) table = 0;
+        uint32_t count = std::min(length, net[table].size() - offset);
+        header head = { 'S', count };
+        slice where = { table, offset };
+        values.resize(count);
+        if (!write_all(fd, &head, sizeof(head)) || !write_all(fd, &where, sizeof(where))
+                || !read_all(fd, &head, sizeof(head)) || head.count != count
+                || !read_all(fd, values.data(), sizeof(float) * count))
+            throw std::runtime_error("parameter server disconnected");
+        const weight& w = net[table];
+        for (uint32_t i = 0; i < count; i++) // avoid allocating the pages which are still all zero
+            if (values[i] != w[offset + i]) net[table][offset + i] = values[i];
+        offset += count;
+        if (offset >= net[table].size()) table++, offset = 0;
+    }
+
+private:
+    size_t sync;
+    size_t length;
+    size_t episodes;
+    uint32_t table;
+    uint32_t offset;
+    std::unordered_map<uint32_t, float> deltas;
+    std::vector<entry> buffer;
+    std::vector<float> values;
+};
+
+/**
+ * the server side, which owns the master copy of the weight tables
+ *
+ * it serves until all clients have disconnected, or until SIGINT/SIGTERM is received
+ */
+class param_server : public param_socket {
+public:
+    param_server(const std::string& path, std::vector<weight>& net) : path(path), net(net) {
+        ::unlink(path.c_str());
+        fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un addr = address(path);
+        if (fd == -1 || ::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || ::listen(fd, 64) != 0)
+            throw std::runtime_error("cannot listen on " + path);
+    }
+    ~param_server() {
+        for (pollfd& p : clients) ::close(p.fd);
+        ::unlink(path.c_str());
+    }
+
+    void serve() {
+        signal_flag() = 0;
+        std::signal(SIGINT, [](int) { signal_flag() = 1; });
+        std::signal(SIGTERM, [](int) { signal_flag() = 1; });
+
+        size_t served = 0, pushed = 0, pulled = 0;
+        while (signal_flag() == 0 && (served == 0 || clients.size())) {
+            std::vector<pollfd> fds(1, pollfd{ fd, POLLIN, 0 });
+            fds.insert(fds.end(), clients.begin(), clients.end());
+            if (::poll(fds.data(), fds.size(), 1000) <= 0) continue;
+
+            if (fds[0].revents & POLLIN) {
+                int cl = ::accept(fd, nullptr, nullptr);
+                if (cl != -1) clients.push_back(pollfd{ cl, POLLIN, 0 }), served++;
+            }
+            for (size_t i = 1; i < fds.size(); i++) {
+                if (fds[i].revents == 0) continue;
+                if (!handle(fds[i].fd, pushed, pulled)) {
+                    ::close(fds[i].fd);
+                    clients.erase(std::find_if(clients.begin(), clients.end(), [&](const pollfd& p) { return p.fd == fds[i].fd; }));
+                }
+            }
+        }
+
+        std::cout << "param-server: " << served << " clients, " << pushed << " entries pushed, " << pulled << " entries pulled, ";
+        std::cout << (bytes_recv() >> 10) << "KB received, " << (bytes_sent() >> 10) << "KB sent" << std::endl;
+    }
+
+private:
+    bool handle(int cl, size_t& pushed, size_t& pulled) {
+        header head;
+        if (!read_all(cl, &head, sizeof(head))) return false;
+        if (head.type == 'P') {
+            buffer.resize(head.count);
+            values.resize(head.count);
+            if (!read_all(cl, buffer.data(), sizeof(entry) * head.count)) return false;
+            for (size_t i = 0; i < buffer.size(); i++) {
+                uint32_t t = buffer[i].key >> 24, k = buffer[i].key & 0xffffff;
+                if (t >= net.size() || k >= net[t].size()) return false;
+                values[i] = (net[t][k] += buffer[i].delta);
+            }
+            pushed += head.count;
+        } else if (head.type == 'S') {
+            slice where;
+            if (!read_all(cl, &where, sizeof(where))) return false;
+            if (where.table >= net.size() || size_t(where.offset) + head.count > net[where.table].size()) return false;
+            values.resize(head.count);
+            const weight& w = net[where.table];
+            for (uint32_t i = 0; i < head.count; i++)
+                values[i] = w[where.offset + i];
+            pulled += head.count;
+        } else {
+            return false;
+        }
+        head.type = 'V';
+        return write_all(cl, &head, sizeof(head)) && write_all(cl, values.data(), sizeof(float) * values.size());
+    }
+
+    static volatile std::sig_atomic_t& signal_flag() { static volatile std::sig_atomic_t flag = 0; return flag; }
+
+private:
+    std::string path;
+    std::vector<weight>& net;
+    std::vector<pollfd> clients;
+    std::vector<entry> buffer;
+    std::vector<float> values;
+};
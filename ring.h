@@ -0,0 +1,58 @@
+#pragma once
+#include <vector>
+#include <atomic>
+#include <utility>
+#include <cstddef>
+
+/**
+ * bounded lock-free single-producer single-consumer ring
+ *
+ * the producer only writes 'tail' and the consumer only writes 'head', each published by a release store;
+ * the capacity is rounded up to a power of two, and the indices are padded to separate cache lines
+ */
+template<typename type>
+class spsc_ring {
+public:
+    spsc_ring(size_t capacity) : slot(round(capacity)), mask(slot.size() - 1), head(0), tail(0) {}
+    spsc_ring(const spsc_ring&) = delete;
+    spsc_ring& operator =(const spsc_ring&) = delete;
+
+    /**
+     * push an item, return false (and keep the item) if the ring is full
+     */
+    bool push(type& item) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) > mask) return false;
+        slot[t & mask] = std::move(item);
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * pop an item, return false if the ring is empty
+     */
+    bool pop(type& item) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) return false;
+        item = std::move(slot[h & mask]);
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t capacity() const { return slot.size(); }
+
+private:
+    static size_t round(size_t n) {
+        size_t size = 1;
+        while (size < n) size <<= 1;
+        return size;
+    }
+
+private:
+    std::vector<type> slot;
+    size_t mask;
+    char pad0[64];
+    std::atomic<size_t> head;
+    char pad1[64];
+    std::atomic<size_t> tail;
+};
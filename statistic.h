@@ -7,6 +7,8 @@
 #include "action.h"
 #include "agent.h"
 #include "episode.h"
+#include "histogram.h"
+#include "telemetry.h"
 
 class statistic {
 public:
@@ -21,7 +23,12 @@ public:
         : total(total),
           block(block ? block : total),
           limit(limit ? limit : total),
-          count(0) {}
+          count(0),
+          played_moves(0),
+          played_episodes(0),
+          heap_mark({ 0, 0 }),
+          mark_moves(0),
+          mark_episodes(0) {}
 
 public:
     /**
@@ -35,6 +42,9 @@ public:
      *        4096    98.4%  (4.7%)
      *        8192    93.7%  (22.4%)
      *        16384   71.3%  (71.3%)
+     *        play    p50 = 182us, p90 = 255us, p99 = 446us, max = 2.11ms
+     *        evil    p50 = 3.07us, p90 = 4.1us, p99 = 8.19us, max = 41.5us
+     *        alloc   3.2 per move (412.5B), 1204.0 per episode (155012.0B)
      *
      * where (block = 1000 by default)
      *  '1000': current index (n)
@@ -45,12 +55,16 @@ public:
      *                                  the average speed of environment is 896715
      *  '93.7%': 93.7% (937 games) reached 8192-tiles (a.k.a. win rate of 8192-tile)
      *  '22.4%': 22.4% (224 games) terminated with 8192-tiles (the largest)
+     *  'play p50 = 182us, ...': the percentiles of the per-move latency of player (and environment)
+     *  'alloc 3.2 per move ...': the heap allocations (and bytes) per move and per episode played since
+     *                            the last show, only if the allocations are tracked (see profiler)
      */
     void show(bool tstat = true) const {
         size_t blk = std::min(data.size(), block);
         size_t stat[64] = { 0 };
         size_t sop = 0, pop = 0, eop = 0;
         time_t sdu = 0, pdu = 0, edu = 0;
+        histogram plat, elat;
         board::reward sum = 0, max = 0;
         auto it = data.end();
         for (size_t i = 0; i < blk; i++) {
@@ -64,6 +78,12 @@ public:
             sdu += ep.time();
             pdu += ep.time(action::slide::type);
             edu += ep.time(action::place::type);
+            if (tstat) plat += ep.latency(action::slide::type);
+            if (tstat) elat += ep.latency(action::place::type);
+        }
+        if (blk == count) { // prefer the full resolution ones, e.g., of the loaded records
+            plat = play_latency;
+            elat = evil_latency;
         }
 
         std::ios ff(nullptr);
@@ -72,9 +92,9 @@ public:
         std::cout << count << "\t";
         std::cout << "avg = " << (sum / blk) << ", ";
         std::cout << "max = " << (max) << ", ";
-        std::cout << "ops = " << (sop * 1000.0 / sdu);
-        std::cout <<     " (" << (pop * 1000.0 / pdu);
-        std::cout <<      "|" << (eop * 1000.0 / edu) << ")";
+        std::cout << "ops = " << (sop * 1e9 / sdu);
+        std::cout <<     " (" << (pop * 1e9 / pdu);
+        std::cout <<      "|" << (eop * 1e9 / edu) << ")";
         std::cout << std::endl;
         std::cout.copyfmt(ff);
 
@@ -88,6 +108,9 @@ public:
             std::cout << "\t" "(" << (stat[t] * 100.0 / blk) << "%" ")"; // percentage of ending
             std::cout << std::endl;
         }
+        if (plat.count()) std::cout << "\t" "play" "\t" << plat.summary() << std::endl;
+        if (elat.count()) std::cout << "\t" "evil" "\t" << elat.summary() << std::endl;
+        if (profiler::tracking()) show_allocations();
         std::cout << std::endl;
     }
 
@@ -102,7 +125,12 @@ public:
         return count >= total;
     }
 
+    size_t remaining() const {
+        return total > count ? total - count : 0;
+    }
+
     void open_episode(const std::string& flag = "") {
+        if (!played_episodes) mark_allocations();
         if (count++ >= limit) data.pop_front();
         data.emplace_back();
         data.back().open_episode(flag);
@@ -110,6 +138,20 @@ public:
 
     void close_episode(const std::string& flag = "") {
         data.back().close_episode(flag);
+        accumulate(data.back());
+        record(data.back());
+        if (count % block == 0) show();
+    }
+
+    /**
+     * append a finished episode, e.g., one played by a worker thread
+     */
+    void push_episode(episode&& ep) {
+        if (!played_episodes) mark_allocations();
+        if (count++ >= limit) data.pop_front();
+        data.push_back(std::move(ep));
+        accumulate(data.back());
+        record(data.back());
         if (count % block == 0) show();
     }
 
@@ -125,25 +167,91 @@ public:
         return data.back();
     }
 
+    /**
+     * the per-move latencies of all the episodes so far, including those no longer kept
+     */
+    const histogram& latency(unsigned who) const {
+        return who == action::slide::type ? play_latency : evil_latency;
+    }
+
+    /**
+     * the records are followed by an empty line and the latency histograms at full resolution,
+     * since the records only keep the time of moves in milliseconds
+     */
     friend std::ostream& operator <<(std::ostream& out, const statistic& stat) {
         for (const episode& rec : stat.data) out << rec << std::endl;
+        out << std::endl;
+        out << "latency play " << stat.play_latency << std::endl;
+        out << "latency evil " << stat.evil_latency << std::endl;
         return out;
     }
     friend std::istream& operator >>(std::istream& in, statistic& stat) {
         for (std::string line; std::getline(in, line) && line.size(); ) {
             stat.data.emplace_back();
             std::stringstream(line) >> stat.data.back();
+            stat.accumulate(stat.data.back());
         }
         stat.total = std::max(stat.total, stat.data.size());
         stat.count = stat.data.size();
+        for (std::string line, head, role; std::getline(in, line); ) {
+            std::stringstream ss(line);
+            if (!(ss >> head >> role) || head != "latency") continue;
+            if (role == "play") ss >> stat.play_latency;
+            if (role == "evil") ss >> stat.evil_latency;
+        }
         return in;
     }
 
+private:
+    void accumulate(const episode& ep) {
+        play_latency += ep.latency(action::slide::type);
+        evil_latency += ep.latency(action::place::type);
+    }
+
+    /**
+     * report a finished episode to the telemetry, but not the loaded ones
+     */
+    void record(const episode& ep) {
+        played_moves += ep.step();
+        played_episodes++;
+        telemetry::record_episode(ep.score(), *std::max_element(&(ep.state()(0)), &(ep.state()(16))), ep.step());
+    }
+
+    /**
+     * show the allocations per move and per episode since the last mark, then mark again
+     */
+    void show_allocations() const {
+        profiler::heap_usage now = profiler::allocations();
+        size_t moves = played_moves - mark_moves, episodes = played_episodes - mark_episodes;
+        if (moves && episodes) {
+            uint64_t n = now.count - heap_mark.count, bytes = now.bytes - heap_mark.bytes;
+            std::ios ff(nullptr);
+            ff.copyfmt(std::cout);
+            std::cout << std::fixed << std::setprecision(1);
+            std::cout << "\t" "alloc" "\t" << (double(n) / moves) << " per move (" << (double(bytes) / moves) << "B), ";
+            std::cout << (double(n) / episodes) << " per episode (" << (double(bytes) / episodes) << "B)" << std::endl;
+            std::cout.copyfmt(ff);
+        }
+        mark_allocations();
+    }
+    void mark_allocations() const {
+        heap_mark = profiler::allocations();
+        mark_moves = played_moves;
+        mark_episodes = played_episodes;
+    }
+
 private:
     size_t total;
     size_t block;
     size_t limit;
     size_t count;
     std::list<episode> data;
+    histogram play_latency;
+    histogram evil_latency;
+    size_t played_moves; // of the episodes played (not loaded), for the allocations per move
+    size_t played_episodes;
+    mutable profiler::heap_usage heap_mark;
+    mutable size_t mark_moves;
+    mutable size_t mark_episodes;
     const std::array<int, 15> base = {{0, 1, 2, 3, 6, 12, 24, 48, 96, 192, 384, 768, 1536, 3072, 6144}};
 };
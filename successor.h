@@ -0,0 +1,80 @@
+#pragma once
+#include <array>
+#include <type_traits>
+#include "board.h"
+
+/**
+ * exact chance outcomes of the environment after a slide
+ *
+ * each (position, next hint) is enumerated exactly once with its probability, where
+ *  the position is uniform among the empty cells of the given space,
+ *  the next hint is drawn from the bag after the tile to place is removed, or
+ *  it is a bonus tile with probability 1/21 once bonus tiles are available,
+ *  spread uniformly over the bonus tiles 4 ... (max - 3)
+ *
+ * the outcomes are kept in a fixed-capacity buffer, hence no allocation is involved,
+ * and the enumeration order is deterministic (by position, then by hint)
+ *
+ * if the value below does not depend on the next hint (e.g., the next layer is evaluated as leaves),
+ * the hints can be merged so that only one outcome per position is enumerated
+ */
+class successor {
+public:
+    struct outcome {
+        unsigned pos;
+        board::cell hint;
+        float prob;
+
+        board::reward apply(board& b) const { return b.place(pos, b.get_next_tile(), hint); }
+    };
+
+    static constexpr size_t capacity = 64;
+
+public:
+    successor(const board& after, const std::array<int, 4>& space, bool merge_hints = false) : num(0) {
+        board b = after;
+        b.remove_tile(b.get_next_tile());
+
+        std::array<board::cell, 16> hints;
+        std::array<float, 16> probs;
+        size_t nhint = 0;
+        bool bonus = after.get_tile_counter() >= 20 && after.get_max_tile() >= 7;
+        float basic = bonus ? 20.0f / 21.0f : 1.0f;
+        for (board::cell t = 1; t < 4; t++) {
+            if (b.get_bag_count(t) == 0) continue;
+            hints[nhint] = t;
+            probs[nhint++] = basic * b.get_bag_count(t) / b.get_bag_size();
+        }
+        if (bonus) {
+            board::cell last = after.get_max_tile() - 3;
+            for (board::cell t = 4; t <= last && nhint < hints.size(); t++) {
+                hints[nhint] = t;
+                probs[nhint++] = (1.0f / 21.0f) / (last - 3);
+            }
+        }
+
+        size_t npos = 0;
+        for (int pos : space) npos += (after(pos) == 0);
+        for (int pos : space) {
+            if (after(pos) != 0) continue;
+            if (merge_hints && nhint) {
+                buf[num++] = { unsigned(pos), hints[0], 1.0f / npos };
+                continue;
+            }
+            for (size_t i = 0; i < nhint && num < capacity; i++)
+                buf[num++] = { unsigned(pos), hints[i], probs[i] / npos };
+        }
+    }
+
+    size_t size() const { return num; }
+    bool empty() const { return num == 0; }
+    const outcome* begin() const { return buf.data(); }
+    const outcome* end() const { return buf.data() + num; }
+    const outcome& operator [](size_t i) const { return buf[i]; }
+
+private:
+    std::array<outcome, capacity> buf;
+    size_t num;
+};
+
+static_assert(std::is_trivially_copyable<board>::value, "board should be trivially copyable for the search");
@@ -0,0 +1,310 @@
+#pragma once
+#include <array>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/**
+ * live telemetry of a run, exported in the Prometheus text format
+ *
+ * the training loop records samples once per episode (a short lock each), and a background thread
+ * renders them every 'period' seconds, either to a file which is rewritten atomically (a temporary file
+ * is renamed, e.g., for the textfile collector of node_exporter), or to the clients of a unix socket
+ * given as "unix:/path", each of which gets the latest metrics once, as an HTTP response if it sends
+ * a GET request (e.g., curl --unix-socket /path http://localhost/metrics)
+ *
+ * the _total counters cover the whole run, while the rates, the scores, the tile reach rates, and the TD error
+ * cover the last period; the occupancy of the weight tables is sampled by the training thread once per period,
+ * since counting the pages is too costly per episode
+ */
+class telemetry {
+public:
+    /**
+     * start exporting to the target every 'period' seconds, return false if the target cannot be opened
+     */
+    static bool start(const std::string& target, double period = 10) {
+        state_t& s = state();
+        if (s.worker.joinable()) return false;
+        s.period = std::chrono::milliseconds(long(std::max(period, 0.1) * 1000));
+        s.started = s.window.since = clock::now();
+        if (target.find("unix:") == 0) {
+            s.path = target.substr(5);
+            s.listener = listen_on(s.path);
+            if (s.listener == -1) return false;
+        } else {
+            s.path = target;
+            if (!publish(s.path, render())) return false;
+        }
+        s.stop = false;
+        s.worker = std::thread(run);
+        return true;
+    }
+
+    /**
+     * stop exporting, after the metrics are rendered once more
+     */
+    static void stop() {
+        state_t& s = state();
+        if (!s.worker.joinable()) return;
+        {
+            std::lock_guard<std::mutex> guard(s.lock);
+            s.stop = true;
+        }
+        s.wake.notify_one();
+        s.worker.join();
+        if (s.listener != -1) {
+            ::close(s.listener);
+            ::unlink(s.path.c_str());
+            s.listener = -1;
+        }
+    }
+
+    static bool enabled() { return state().worker.joinable(); }
+
+    /**
+     * record a finished episode, with its score, the index of its largest tile, and its number of moves
+     */
+    static void record_episode(uint64_t score, unsigned max_tile, size_t moves) {
+        if (!enabled()) return;
+        state_t& s = state();
+        std::lock_guard<std::mutex> guard(s.lock);
+        s.episodes++;
+        s.moves += moves;
+        s.ending[std::min<size_t>(max_tile, s.ending.size() - 1)]++;
+        s.window.episodes++;
+        s.window.moves += moves;
+        s.window.score_sum += score;
+        s.window.score_max = std::max(s.window.score_max, score);
+        s.window.ending[std::min<size_t>(max_tile, s.window.ending.size() - 1)]++;
+    }
+
+    /**
+     * record the sum of the absolute TD errors of n updates
+     */
+    static void record_error(double sum, size_t n) {
+        if (!enabled()) return;
+        state_t& s = state();
+        std::lock_guard<std::mutex> guard(s.lock);
+        s.window.error_sum += sum;
+        s.window.error_count += n;
+    }
+
+    /**
+     * record the time the caller was blocked by saving a checkpoint
+     */
+    static void record_checkpoint(double sec) {
+        if (!enabled()) return;
+        state_t& s = state();
+        std::lock_guard<std::mutex> guard(s.lock);
+        s.checkpoints++;
+        s.checkpoint_sum += sec;
+        s.checkpoint_last = sec;
+    }
+
+    /**
+     * whether a new sample of the occupancy is wanted, polled by the training thread
+     */
+    static bool wants_occupancy() {
+        if (!enabled()) return false;
+        std::lock_guard<std::mutex> guard(state().lock);
+        return state().sample_occupancy;
+    }
+    static void record_occupancy(size_t used, size_t total) {
+        if (!enabled()) return;
+        state_t& s = state();
+        std::lock_guard<std::mutex> guard(s.lock);
+        s.pages_used = used;
+        s.pages_total = total;
+        s.sample_occupancy = false;
+    }
+
+private:
+    typedef std::chrono::steady_clock clock;
+
+    struct window_t {
+        clock::time_point since;
+        size_t episodes = 0, moves = 0;
+        uint64_t score_sum = 0, score_max = 0;
+        std::array<size_t, 32> ending = {};
+        double error_sum = 0;
+        size_t error_count = 0;
+    };
+
+    struct state_t {
+        std::mutex lock;
+        std::condition_variable wake;
+        std::thread worker;
+        bool stop = false;
+        std::string path;
+        int listener = -1;
+        clock::duration period;
+        clock::time_point started;
+
+        size_t episodes = 0, moves = 0;
+        std::array<size_t, 32> ending = {};
+        size_t checkpoints = 0;
+        double checkpoint_sum = 0, checkpoint_last = 0;
+        size_t pages_used = 0, pages_total = 0;
+        bool sample_occupancy = true;
+        window_t window; // being recorded
+        window_t last; // the last complete period, which is rendered
+        double last_sec = 0;
+    };
+    static state_t& state() { static state_t s; return s; }
+
+    static void run() {
+        state_t& s = state();
+        auto next = clock::now() + s.period;
+        std::unique_lock<std::mutex> guard(s.lock);
+        for (bool last = false; !last; ) {
+            if (s.listener == -1) {
+                s.wake.wait_until(guard, next, [&]() { return s.stop; });
+            } else {
+                // serve the clients until the next period
+                guard.unlock();
+                long ms = std::chrono::duration_cast<std::chrono::milliseconds>(next - clock::now()).count();
+                pollfd fd = { s.listener, POLLIN, 0 };
+                if (::poll(&fd, 1, int(std::max(std::min(ms, 200l), 0l))) > 0) serve(::accept(s.listener, nullptr, nullptr));
+                guard.lock();
+            }
+            last = s.stop;
+            if (clock::now() < next && !last) continue;
+            next += s.period;
+            // roll the window, and ask the training thread for the occupancy
+            s.last_sec = std::chrono::duration<double>(clock::now() - s.window.since).count();
+            s.last = s.window;
+            s.window = window_t();
+            s.window.since = clock::now();
+            s.sample_occupancy = true;
+            if (s.listener == -1) {
+                guard.unlock();
+                publish(s.path, render());
+                guard.lock();
+            }
+        }
+    }
+
+    /**
+     * write the text to a temporary file then rename it, so readers never see a partial file
+     */
+    static bool publish(const std::string& path, const std::string& text) {
+        std::string temp = path + ".tmp";
+        std::ofstream out(temp, std::ios::out | std::ios::trunc);
+        if (!out.is_open()) return false;
+        out << text;
+        out.close();
+        return out && std::rename(temp.c_str(), path.c_str()) == 0;
+    }
+
+    static int listen_on(const std::string& path) {
+        sockaddr_un addr;
+        if (path.size() >= sizeof(addr.sun_path)) return -1;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        std::strcpy(addr.sun_path, path.c_str());
+        int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd == -1) return -1;
+        ::unlink(path.c_str());
+        if (::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || ::listen(fd, 16) != 0) {
+            ::close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    static void serve(int fd) {
+        if (fd == -1) return;
+        // wait briefly for a request, which is optional
+        char req[1024] = {};
+        pollfd pfd = { fd, POLLIN, 0 };
+        if (::poll(&pfd, 1, 50) > 0) (void) ::recv(fd, req, sizeof(req) - 1, MSG_DONTWAIT);
+        std::string text = render();
+        if (std::strncmp(req, "GET", 3) == 0) {
+            std::stringstream head;
+            head << "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " << text.size() << "\r\n\r\n";
+            text = head.str() + text;
+        }
+        for (size_t off = 0; off < text.size(); ) {
+            ssize_t n = ::send(fd, text.data() + off, text.size() - off, MSG_NOSIGNAL);
+            if (n <= 0) break;
+            off += n;
+        }
+        ::close(fd);
+    }
+
+    /**
+     * the resident set size of the process in bytes
+     */
+    static uint64_t resident() {
+        std::ifstream in("/proc/self/statm");
+        uint64_t size = 0, rss = 0;
+        in >> size >> rss;
+        return rss * ::sysconf(_SC_PAGESIZE);
+    }
+
+    static std::string render() {
+        const std::array<int, 15> base = {{0, 1, 2, 3, 6, 12, 24, 48, 96, 192, 384, 768, 1536, 3072, 6144}};
+        state_t& s = state();
+        std::stringstream out;
+        auto metric = [&](const char* name, const char* type, const char* help) {
+            out << "# HELP threes_" << name << " " << help << "\n";
+            out << "# TYPE threes_" << name << " " << type << "\n";
+        };
+
+        std::lock_guard<std::mutex> guard(s.lock);
+        const window_t& w = s.last;
+        double sec = std::max(s.last_sec, 1e-9);
+        metric("episodes_total", "counter", "Episodes finished.");
+        out << "threes_episodes_total " << s.episodes << "\n";
+        metric("moves_total", "counter", "Moves played by both sides.");
+        out << "threes_moves_total " << s.moves << "\n";
+        metric("episodes_per_second", "gauge", "Episodes finished per second in the last period.");
+        out << "threes_episodes_per_second " << (w.episodes / sec) << "\n";
+        metric("moves_per_second", "gauge", "Moves played per second in the last period.");
+        out << "threes_moves_per_second " << (w.moves / sec) << "\n";
+        metric("score_avg", "gauge", "Average score of the episodes in the last period.");
+        out << "threes_score_avg " << (w.episodes ? double(w.score_sum) / w.episodes : 0) << "\n";
+        metric("score_max", "gauge", "Maximum score of the episodes in the last period.");
+        out << "threes_score_max " << w.score_max << "\n";
+
+        metric("tile_reach_ratio", "gauge", "Ratio of the episodes in the last period which reached the tile.");
+        size_t reach = w.episodes;
+        for (size_t t = 1; t < base.size() && reach; reach -= w.ending[t++]) {
+            out << "threes_tile_reach_ratio{tile=\"" << base[t] << "\"} " << (double(reach) / w.episodes) << "\n";
+        }
+        metric("tile_reached_total", "counter", "Episodes which reached the tile.");
+        reach = s.episodes;
+        for (size_t t = 1; t < base.size() && reach; reach -= s.ending[t++]) {
+            out << "threes_tile_reached_total{tile=\"" << base[t] << "\"} " << reach << "\n";
+        }
+
+        metric("td_error_mean", "gauge", "Mean absolute TD error of the updates in the last period.");
+        out << "threes_td_error_mean " << (w.error_count ? w.error_sum / w.error_count : 0) << "\n";
+        metric("weight_pages_used", "gauge", "Materialized pages of the player's weight tables.");
+        out << "threes_weight_pages_used " << s.pages_used << "\n";
+        metric("weight_occupancy_ratio", "gauge", "Ratio of the materialized pages of the player's weight tables.");
+        out << "threes_weight_occupancy_ratio " << (s.pages_total ? double(s.pages_used) / s.pages_total : 0) << "\n";
+        metric("checkpoint_seconds", "summary", "Time the training was blocked by saving checkpoints.");
+        out << "threes_checkpoint_seconds_sum " << s.checkpoint_sum << "\n";
+        out << "threes_checkpoint_seconds_count " << s.checkpoints << "\n";
+        metric("checkpoint_last_seconds", "gauge", "Time the training was blocked by the last checkpoint.");
+        out << "threes_checkpoint_last_seconds " << s.checkpoint_last << "\n";
+        metric("resident_memory_bytes", "gauge", "Resident set size of the process.");
+        out << "threes_resident_memory_bytes " << resident() << "\n";
+        metric("uptime_seconds", "gauge", "Time since the telemetry started.");
+        out << "threes_uptime_seconds " << std::chrono::duration<double>(clock::now() - s.started).count() << "\n";
+        return out.str();
+    }
+};
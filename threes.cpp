@@ -10,8 +10,17 @@
 #include <fstream>
 #include <iterator>
 #include <string>
-#include <regex>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <atomic>
 #include <memory>
+#include <sstream>
+#include <iomanip>
+#include <new>
+#include <cstdlib>
+#include <malloc.h>
+#include <sys/resource.h>
 #include "board.h"
 #include "action.h"
 #include "agent.h"
@@ -19,9 +28,45 @@
 #include "statistic.h"
 #include "arena.h"
 #include "io.h"
+#include "ring.h"
+#include "topology.h"
+#include "reload.h"
+#include "batch.h"
+
+/**
+ * the global allocation functions, which account the allocations to the phases of the profiler
+ * if --allocs is given; otherwise they only forward to malloc and free
+ * the bytes are the usable sizes of the blocks, so that a free needs no header to know its size
+ */
+void* operator new(std::size_t size) {
+    void* p;
+    while (!(p = std::malloc(size ? size : 1))) {
+        std::new_handler handler = std::get_new_handler();
+        if (!handler) throw std::bad_alloc();
+        handler();
+    }
+    if (profiler::tracking()) profiler::allocated(::malloc_usable_size(p));
+    return p;
+}
+void* operator new[](std::size_t size) { return ::operator new(size); }
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    try { return ::operator new(size); } catch (std::bad_alloc&) { return nullptr; }
+}
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept { return ::operator new(size, std::nothrow); }
+void operator delete(void* p) noexcept {
+    if (p && profiler::tracking()) profiler::freed(::malloc_usable_size(p));
+    std::free(p);
+}
+void operator delete[](void* p) noexcept { ::operator delete(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { ::operator delete(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { ::operator delete(p); }
 
 int shell(int argc, const char* argv[]) {
     arena host("anonymous");
+    std::ifstream replay;
+    bool pondering = false;
+    double watch = 0;
+    std::vector<std::pair<std::shared_ptr<agent>, reloader::factory>> managed;
 
     for (int i = 1; i < argc; i++) {
         std::string para(argv[i]);
@@ -31,70 +76,121 @@ int shell(int argc, const char* argv[]) {
             host.set_login(para.substr(para.find("=") + 1));
         } else if (para.find("--save=") == 0 || para.find("--dump=") == 0) {
             host.set_dump_file(para.substr(para.find("=") + 1));
+        } else if (para.find("--profile") == 0) {
+            profiler::enable();
+        } else if (para.find("--allocs") == 0) {
+            profiler::track_allocations();
+        } else if (para.find("--ponder") == 0) {
+            pondering = true;
+        } else if (para.find("--watch") == 0) {
+            watch = para.find("=") != std::string::npos ? std::stod(para.substr(para.find("=") + 1)) : 2;
+        } else if (para.find("--replay=") == 0) {
+            replay.open(para.substr(para.find("=") + 1), std::ios::in);
+            if (!replay.is_open()) std::exit(-1);
         } else if (para.find("--play") == 0) {
-            std::shared_ptr<agent> play(new TDL_player(para.substr(para.find("=") + 1)));
+            std::string args = para.substr(para.find("=") + 1);
+            std::shared_ptr<agent> play(new TDL_player(args));
             host.register_agent(play);
+            managed.emplace_back(play, [args]() { return std::make_shared<TDL_player>(args + " reload=1"); });
         } else if (para.find("--evil") == 0) {
-            std::shared_ptr<agent> evil(new rndenv(para.substr(para.find("=") + 1)));
+            std::string args = para.substr(para.find("=") + 1);
+            std::shared_ptr<agent> evil(new rndenv(args));
             host.register_agent(evil);
+            managed.emplace_back(evil, [args]() { return std::make_shared<rndenv>(args + " reload=1"); });
         }
     }
 
-    std::regex match_move("^#\\S+ \\S+$"); // e.g. "#M0001 ?", "#M0001 #U"
-    std::regex match_ctrl("^#\\S+ \\S+ \\S+$"); // e.g. "#M0001 open Slider:Placer", "#M0001 close score=15424"
-    std::regex arena_ctrl("^[@$].+$"); // e.g. "@ login", "@ error the account "Name" has already been taken"
-    std::regex arena_info("^[?%].+$"); // e.g. "? message from anonymous: 2048!!!"
+    // the agents are rebuilt in the background when their weight files change (polled with --watch=sec,
+    // or checked by "@ reload"), and are swapped in before the next message; see reloader
+    reloader reload(watch);
+    for (auto& who : managed) reload.manage(who.first, who.second);
+
+    // with a replay file, the recorded session is fed instead of stdin, and
+    // the time spent outside the agents (parsing, dispatching, writing) is reported
+    input in(replay.is_open() ? replay : std::cin);
+    writer reply(std::cout);
+    typedef std::chrono::steady_clock clock;
+    clock::duration total(0), think(0);
+    size_t count = 0;
+
+    // with --ponder, our agents search in the background while the input is idle, for the matches
+    // in which the opponent is to move; the pondering is stopped before any message is handled,
+    // so the agents are never used by both threads at once
+    std::atomic<bool> stop(false);
+    std::thread ponder;
+    auto halt = [&]() {
+        if (!ponder.joinable()) return;
+        stop = true;
+        ponder.join();
+    };
+    auto resume = [&]() {
+        std::vector<std::pair<agent*, board>> tasks;
+        for (auto ep : host.list_matches()) {
+            if (agent* who = ep->pondering_agent()) tasks.emplace_back(who, ep->state());
+        }
+        if (tasks.empty()) return;
+        stop = false;
+        ponder = std::thread([&stop, tasks]() {
+            for (size_t i = 0; i < tasks.size() && !stop; i++) tasks[i].first->ponder(tasks[i].second, stop);
+        });
+    };
 
-    for (std::string command; input() >> command; ) {
+    std::string command, id;
+    profiler::scope prof(profiler::io); // the shell itself is i/o, except the agents
+    for (clock::time_point start; (start = clock::now()), in >> command; ) {
+        halt();
+        reload.adopt([&](std::shared_ptr<agent> who) { return host.replace_agent(who); });
+        count++;
+        message msg(command);
         try {
-            if (std::regex_match(command, match_move)) {
-                std::string id, move;
-                std::stringstream(command) >> id >> move;
+            if (msg.type() == message::move) {
+                msg[0].str(id);
+                const message::token& move = msg[1];
 
-               if (move == "?") {
+                if (move == "?") {
                     // your agent need to take an action
+                    clock::time_point begin = clock::now();
                     action a = host.at(id).take_action();
+                    think += clock::now() - begin;
                     host.at(id).apply_action(a);
                     if (a.type() == action::place::type) {
                         int hint = host.at(id).state().info(); // your hint tile here
-                        output() << id << ' ' << a << '+' << hint << std::endl;
+                        reply << id << ' ' << a << '+' << hint << '\n';
                     } else {
-                        output() << id << ' ' << a << std::endl;
+                        reply << id << ' ' << a << '\n';
                     }
-               } else {
-                    // perform your opponent's action
-                    action a;
-                    std::stringstream(move) >> a;
-                    host.at(id).apply_action(a); // you should pass the hint tile to your player
-               }
+                } else {
+                    // perform your opponent's action, including the hint tile if any
+                    action a = action::parse(move.begin(), move.size());
+                    host.at(id).apply_action(a);
+                }
 
-            } else if (std::regex_match(command, match_ctrl)) {
-                std::string id, ctrl, tag;
-                std::stringstream(command) >> id >> ctrl >> tag;
+            } else if (msg.type() == message::ctrl) {
+                msg[0].str(id);
+                const message::token& ctrl = msg[1];
 
                 if (ctrl == "open") {
                     // a new match is pending
-                    if (host.open(id, tag)) {
-                        output() << id << " open accept" << std::endl;
+                    if (host.open(id, msg[2].str())) {
+                        reply << id << " open accept" << '\n';
                     } else {
-                        output() << id << " open reject" << std::endl;
+                        reply << id << " open reject" << '\n';
                     }
                 } else if (ctrl == "close") {
                     // a match is finished
-                    host.close(id, tag);
+                    host.close(id, msg[2].str());
                 }
 
-            } else if (std::regex_match(command, arena_ctrl)) {
-                std::string ctrl;
-                std::stringstream(command).ignore(1) >> ctrl;
+            } else if (msg.type() == message::arena_ctrl) {
+                const message::token& ctrl = msg[0];
 
                 if (ctrl == "login") {
                     // register yourself and your agents
-                    std::stringstream agents;
+                    reply << "@ " << "login " << host.login();
                     for (auto who : host.list_agents()) {
-                        agents << " " << who->name() << "(" << who->role() << ")";
+                        reply << " " << who->name() << "(" << who->role() << ")";
                     }
-                    output("@ ") << "login " << host.login() << agents.str() << std::endl;
+                    reply << '\n';
 
                 } else if (ctrl == "status") {
                     // display current local status
@@ -110,35 +206,323 @@ int shell(int argc, const char* argv[]) {
                     }
                     info() << "----- status -----" << std::endl;
 
+                } else if (ctrl == "reload") {
+                    // check the weight files of the agents, which are reloaded in the background
+                    reload.request();
+
                 } else if (ctrl == "error" || ctrl == "exit") {
                     // some error messages or exit command
-                    std::string message = command.substr(command.find_first_not_of("@$ "));
-                    info() << message << std::endl;
+                    info() << msg.content() << std::endl;
                     break;
                 }
 
-            } else if (std::regex_match(command, arena_info)) {
+            } else if (msg.type() == message::arena_info) {
                 // message from arena server
             }
         } catch (std::exception& ex) {
             std::string message = std::string(typeid(ex).name()) + ": " + ex.what();
             message = message.substr(0, message.find_first_of("\r\n"));
-            output("? ") << "exception " << message << " at \"" << command << "\"" << std::endl;
+            reply << "? " << "exception " << message << " at \"" << command << "\"" << '\n';
+        }
+        // replies are flushed once the pending input batch has been consumed
+        if (!in.pending()) {
+            reply.flush();
+            if (pondering) resume();
         }
+        total += clock::now() - start;
     }
+    halt();
+    reply.flush();
 
+    profiler::report(std::cerr);
+    if (replay.is_open()) {
+        auto usec = [](clock::duration d) { return std::chrono::duration_cast<std::chrono::microseconds>(d).count(); };
+        info() << "replay: " << count << " messages in " << usec(total) << "us, "
+               << usec(think) << "us in agents, "
+               << (count ? usec(total - think) * 1000 / count : 0) << "ns/message in protocol" << std::endl;
+    }
     return 0;
 }
 
+/**
+ * evaluate the agents without learning by several worker threads
+ * each worker plays with its own agents (and random engines) sharing the read-only weight tables,
+ * and the finished episodes are merged into the statistic
+ * with the replicate policy, worker i is pinned to node (i % nodes) and reads the replica of that node
+ * with 'lanes', each worker plays that many games in lockstep, and game i is seeded by i
+ */
+void evaluate(statistic& stat, const TDL_player& play, const rndenv& evil, size_t threads, topology::policy numa = topology::local, size_t lanes = 0) {
+    typedef std::shared_ptr<weight_agent::network> tables;
+    std::vector<std::pair<tables, tables>> replicas;
+    int nodes = (numa == topology::replicate) ? topology::nodes() : 1;
+    for (int n = 0; n < nodes && nodes > 1; n++) {
+        topology::run_on(n);
+        replicas.emplace_back(play.snapshot(), evil.snapshot());
+        topology::run_anywhere();
+    }
+
+    std::mutex lock;
+    std::atomic<long> quota(stat.remaining());
+    std::atomic<unsigned> started(0);
+    std::vector<std::thread> workers;
+    size_t games = stat.remaining(), moves = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < std::max<size_t>(threads, 1); i++) {
+        workers.emplace_back([&, i]() {
+            std::string seed = "seed=" + std::to_string(i + 1);
+            TDL_player play_(play, seed);
+            rndenv evil_(evil, seed);
+            if (replicas.size()) {
+                topology::run_on(i % nodes);
+                play_.share_weights(replicas[i % nodes].first);
+                evil_.share_weights(replicas[i % nodes].second);
+            }
+            if (lanes) {
+                lockstep sim(play_, evil_, lanes);
+                sim.run([&](unsigned& seed) { return quota-- > 0 && (seed = ++started); },
+                        [&](episode& game, unsigned seed) {
+                    std::lock_guard<std::mutex> guard(lock);
+                    moves += game.step();
+                    stat.push_episode(std::move(game));
+                });
+                return;
+            }
+            while (quota-- > 0) {
+                episode game;
+                play_.open_episode("~:" + evil_.name());
+                evil_.open_episode(play_.name() + ":~");
+                game.open_episode(play_.name() + ":" + evil_.name());
+                while (true) {
+                    agent& who = game.take_turns(play_, evil_);
+                    action move = who.take_action(game.state());
+                    if (game.apply_action(move) != true) break;
+                    if (who.check_for_win(game.state())) break;
+                }
+                agent& win = game.last_turns(play_, evil_);
+                game.close_episode(win.name());
+                play_.close_episode(win.name());
+                evil_.close_episode(win.name());
+                std::lock_guard<std::mutex> guard(lock);
+                moves += game.step();
+                stat.push_episode(std::move(game));
+            }
+        });
+    }
+    for (std::thread& worker : workers) worker.join();
+
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "evaluate: " << games << " games by " << workers.size() << " threads";
+    if (lanes) std::cout << " of " << lanes << " lanes";
+    std::cout << " in " << sec << "s, ";
+    std::cout << size_t(moves / sec) << " moves/s, numa = " << topology::name(numa) << " (" << topology::nodes() << " nodes)" << std::endl;
+}
+
+/**
+ * train by an actor-learner pipeline
+ * the actors play with the latest published snapshot of the weights and pass their episodes and trajectories
+ * to the learner (the caller) through their own lock-free rings; the learner applies the TD updates to the weights,
+ * and publishes a new snapshot every 'publish' episodes, which the actors pick up at their next episode
+ */
+void train_async(statistic& stat, TDL_player& play, rndenv& evil, size_t actors, size_t publish) {
+    struct record {
+        episode game;
+        TDL_player::trajectory states;
+        std::string winner;
+    };
+    typedef std::unique_ptr<record> item;
+
+    std::shared_ptr<weight_agent::network> snapshot = play.snapshot();
+    std::atomic<long> quota(stat.remaining());
+    std::atomic<bool> stop(false);
+    std::vector<std::unique_ptr<spsc_ring<item>>> rings;
+    std::vector<std::unique_ptr<TDL_player>> plays;
+    std::vector<std::unique_ptr<rndenv>> evils;
+    std::vector<std::thread> workers;
+    // the actors are created here, since the learner modifies the agents as soon as it starts
+    for (size_t i = 0; i < actors; i++) {
+        std::string seed = "seed=" + std::to_string(i + 1);
+        rings.emplace_back(new spsc_ring<item>(64));
+        plays.emplace_back(new TDL_player(play, seed));
+        evils.emplace_back(new rndenv(evil, seed));
+    }
+    for (size_t i = 0; i < actors; i++) {
+        workers.emplace_back([&, i]() {
+            TDL_player& play_ = *plays[i];
+            rndenv& evil_ = *evils[i];
+            while (quota-- > 0) {
+                play_.share_weights(std::atomic_load(&snapshot));
+                item rec(new record());
+                episode& game = rec->game;
+                play_.open_episode("~:" + evil_.name());
+                evil_.open_episode(play_.name() + ":~");
+                game.open_episode(play_.name() + ":" + evil_.name());
+                while (true) {
+                    agent& who = game.take_turns(play_, evil_);
+                    action move = who.take_action(game.state());
+                    if (game.apply_action(move) != true) break;
+                    if (who.check_for_win(game.state())) break;
+                }
+                agent& win = game.last_turns(play_, evil_);
+                game.close_episode(win.name());
+                rec->winner = win.name();
+                rec->states = play_.take_trajectory();
+                // the ring only fills up if the learner falls behind
+                while (!rings[i]->push(rec) && !stop) std::this_thread::yield();
+            }
+        });
+    }
+
+    for (size_t learned = 0, next = 0; !stat.is_finished(); ) {
+        item rec;
+        for (size_t n = 0; n < actors && !rec; n++) rings[next++ % actors]->pop(rec);
+        if (!rec) {
+            std::this_thread::yield();
+            continue;
+        }
+        play.training(std::move(rec->states));
+        profiler::scope prof(profiler::bookkeeping);
+        play.close_episode(rec->winner);
+        evil.close_episode(rec->winner);
+        stat.push_episode(std::move(rec->game));
+        if (telemetry::wants_occupancy()) {
+            auto pages = play.page_count();
+            telemetry::record_occupancy(pages.first, pages.second);
+        }
+        if (++learned % publish == 0) {
+            profiler::scope prof(profiler::io);
+            std::atomic_store(&snapshot, play.snapshot());
+        }
+    }
+    stop = true;
+    for (std::thread& worker : workers) worker.join();
+}
+
+/**
+ * benchmark a fixed suite of games for each search depth and each number of threads
+ * game i of the suite seeds both agents with (seed + i), so a suite always plays the same games
+ * for the same weights and search, and the decision checksum (over all the actions of all the games,
+ * independent of the order in which the games finish) can be compared between builds
+ * with 'lanes', the suite of depth 1 is also played in lockstep (see lockstep), which should give the same checksum
+ * with 'ponder' (us), the opponent of the agent to move ponders the state before each move, and is cancelled after
+ * 'ponder' us, which should also give the same checksum, i.e., an aborted search leaves no trace (e.g., in the cache)
+ * the report is in JSON, including the peak RSS of the process
+ */
+void bench(std::ostream& out, const TDL_player& play, const rndenv& evil, size_t games, unsigned seed,
+           const std::vector<size_t>& depths, const std::vector<size_t>& threads, size_t lanes = 0, size_t ponder = 0) {
+    std::vector<std::string> runs;
+    for (size_t depth : depths) {
+        std::vector<size_t> widths = { 0 };
+        if (lanes && depth == 1) widths.push_back(lanes);
+        for (size_t width : widths)
+        for (size_t nthread : threads) {
+            std::atomic<size_t> next(0), moves(0), nodes(0), score(0);
+            std::atomic<uint64_t> checksum(0);
+            std::vector<std::thread> workers;
+            auto start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < std::max<size_t>(nthread, 1); i++) {
+                workers.emplace_back([&]() {
+                    std::string args = "depth=" + std::to_string(depth);
+                    TDL_player play_(play, args);
+                    rndenv evil_(evil, args);
+                    if (width) {
+                        lockstep sim(play_, evil_, width);
+                        sim.run([&](unsigned& s) { size_t g = next++; return g < games && ((s = seed + g), true); },
+                                [&](episode& game, unsigned s) {
+                            uint64_t hash = 0xcbf29ce484222325ull ^ (s - seed);
+                            for (action move : game.actions()) hash = (hash ^ unsigned(move)) * 0x100000001b3ull;
+                            checksum += hash;
+                            moves += game.step();
+                            score += game.score();
+                        });
+                    }
+                    for (size_t g; !width && (g = next++) < games; ) {
+                        play_.seed(seed + g);
+                        evil_.seed(seed + g);
+                        episode game;
+                        play_.open_episode("~:" + evil_.name());
+                        evil_.open_episode(play_.name() + ":~");
+                        game.open_episode(play_.name() + ":" + evil_.name());
+                        uint64_t hash = 0xcbf29ce484222325ull ^ g;
+                        while (true) {
+                            agent& who = game.take_turns(play_, evil_);
+                            if (ponder) {
+                                agent& other = (&who == &play_) ? static_cast<agent&>(evil_) : play_;
+                                std::atomic<bool> stop(false);
+                                std::thread timer([&stop, ponder]() {
+                                    std::this_thread::sleep_for(std::chrono::microseconds(ponder));
+                                    stop = true;
+                                });
+                                other.ponder(game.state(), stop);
+                                timer.join();
+                            }
+                            action move = who.take_action(game.state());
+                            if (game.apply_action(move) != true) break;
+                            hash = (hash ^ unsigned(move)) * 0x100000001b3ull;
+                            if (who.check_for_win(game.state())) break;
+                        }
+                        agent& win = game.last_turns(play_, evil_);
+                        game.close_episode(win.name());
+                        checksum += hash;
+                        moves += game.step();
+                        score += game.score();
+                    }
+                    nodes += play_.node_count() + evil_.node_count();
+                });
+            }
+            for (std::thread& worker : workers) worker.join();
+            double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            std::stringstream run;
+            run << std::fixed << std::setprecision(3);
+            run << "{\"depth\": " << depth << ", \"threads\": " << workers.size();
+            if (width) run << ", \"lanes\": " << width;
+            if (ponder && !width) run << ", \"ponder_us\": " << ponder;
+            run << ", \"seconds\": " << sec;
+            run << ", \"episodes_per_sec\": " << (games / sec) << ", \"moves_per_sec\": " << (moves / sec);
+            run << ", \"nodes_per_sec\": " << (nodes / sec) << ", \"avg_score\": " << (games ? double(score) / games : 0);
+            run << ", \"checksum\": \"" << std::hex << std::setw(16) << std::setfill('0') << checksum.load() << "\"}";
+            runs.push_back(run.str());
+        }
+    }
+
+    struct rusage usage;
+    ::getrusage(RUSAGE_SELF, &usage);
+    out << "{\"bench\": {\"games\": " << games << ", \"seed\": " << seed << ", \"peak_rss_kb\": " << usage.ru_maxrss << ", \"runs\": [";
+    for (size_t i = 0; i < runs.size(); i++) out << (i ? ",\n    " : "\n    ") << runs[i];
+    out << "\n]}}" << std::endl;
+}
+
+/**
+ * parse a comma-separated list of numbers, e.g., "1,2,4"
+ */
+std::vector<size_t> parse_list(const std::string& list) {
+    std::vector<size_t> res;
+    std::stringstream ss(list);
+    for (std::string item; std::getline(ss, item, ','); )
+        if (item.size()) res.push_back(std::stoull(item));
+    return res;
+}
+
 int main(int argc, const char* argv[]) {
-    std::cout << "Threes-Demo: ";
-    std::copy(argv, argv + argc, std::ostream_iterator<const char*>(std::cout, " "));
-    std::cout << std::endl << std::endl;
+    std::ios::sync_with_stdio(false); // only effective before any i/o, the shell relies on it
+    // the banner goes to stderr if stdout is for the JSON report of --bench
+    bool report = std::find(argv + 1, argv + argc, std::string("--bench")) != argv + argc;
+    std::ostream& banner = report ? std::cerr : std::cout;
+    banner << "Threes-Demo: ";
+    std::copy(argv, argv + argc, std::ostream_iterator<const char*>(banner, " "));
+    banner << std::endl << std::endl;
 
     size_t total = 1000, block = 0, limit = 0;
     std::string play_args, evil_args;
-    std::string load, save;
-    bool summary = false;
+    std::string load, save, server;
+    bool summary = false, eval = false;
+    size_t threads = 1, actors = 0, publish = 100, lanes = 0, ponder = 0;
+    std::string bench_out, thread_list = "1", depth_list = std::to_string(EXPECT_SEARCH_LEVEL);
+    bool benchmark = false;
+    unsigned seed = 1;
+    topology::policy numa = topology::local;
+    std::string telemetry_out;
+    double telemetry_period = 10;
     for (int i = 1; i < argc; i++) {
         std::string para(argv[i]);
         if (para.find("--total=") == 0) {
@@ -155,13 +539,64 @@ int main(int argc, const char* argv[]) {
             load = para.substr(para.find("=") + 1);
         } else if (para.find("--save=") == 0) {
             save = para.substr(para.find("=") + 1);
+        } else if (para.find("--eval") == 0) {
+            eval = true;
+        } else if (para.find("--threads=") == 0) {
+            thread_list = para.substr(para.find("=") + 1);
+        } else if (para.find("--bench") == 0) {
+            benchmark = true;
+            if (para.find("=") != std::string::npos) bench_out = para.substr(para.find("=") + 1);
+        } else if (para.find("--batch=") == 0) {
+            lanes = std::stoull(para.substr(para.find("=") + 1));
+        } else if (para.find("--ponder=") == 0) {
+            ponder = std::stoull(para.substr(para.find("=") + 1));
+        } else if (para.find("--depths=") == 0) {
+            depth_list = para.substr(para.find("=") + 1);
+        } else if (para.find("--seed=") == 0) {
+            seed = std::stoul(para.substr(para.find("=") + 1));
+        } else if (para.find("--actors=") == 0) {
+            actors = std::stoull(para.substr(para.find("=") + 1));
+        } else if (para.find("--publish=") == 0) {
+            publish = std::max<size_t>(std::stoull(para.substr(para.find("=") + 1)), 1);
+        } else if (para.find("--numa=") == 0) {
+            numa = topology::parse(para.substr(para.find("=") + 1));
+        } else if (para.find("--telemetry=") == 0) {
+            telemetry_out = para.substr(para.find("=") + 1);
+        } else if (para.find("--telemetry-period=") == 0) {
+            telemetry_period = std::stod(para.substr(para.find("=") + 1));
         } else if (para.find("--summary") == 0) {
             summary = true;
+        } else if (para.find("--profile") == 0) {
+            profiler::enable();
+        } else if (para.find("--allocs") == 0) {
+            profiler::track_allocations();
+        } else if (para.find("--server=") == 0) {
+            server = para.substr(para.find("=") + 1);
         } else if (para.find("--shell") == 0) {
             return shell(argc, argv);
         }
     }
 
+    // only --bench takes a list of thread counts
+    std::vector<size_t> thread_counts = parse_list(thread_list);
+    if (thread_counts.empty() || (!benchmark && thread_counts.size() > 1)) {
+        std::cerr << "--threads=" << thread_list << ": a single number (or a list with --bench) is expected" << std::endl;
+        std::exit(-1);
+    }
+    threads = thread_counts[0];
+
+    if (numa == topology::interleave) {
+        // spread the tables (allocated by this thread) over all the nodes
+        topology::interleave_all();
+    }
+
+    if (server.size()) {
+        // act as the parameter server of the player's weights, pass save=... to save them on exit
+        TDL_player play(play_args);
+        param_server(server, play.weights()).serve();
+        return 0;
+    }
+
     statistic stat(total, block, limit);
 
     if (load.size()) {
@@ -175,29 +610,67 @@ int main(int argc, const char* argv[]) {
     TDL_player play(play_args);
     rndenv evil(evil_args);
 
+    if (benchmark) {
+        // play a fixed suite of --total games for each of --depths and --threads, then report in JSON
+        std::ofstream file;
+        if (bench_out.size()) file.open(bench_out, std::ios::out | std::ios::trunc);
+        if (bench_out.size() && !file.is_open()) std::exit(-1);
+        bench(bench_out.size() ? file : std::cout, play, evil, total, seed, parse_list(depth_list), thread_counts, lanes, ponder);
+        return 0;
+    }
+
+    if (telemetry_out.size()) {
+        // export the metrics of the run every --telemetry-period seconds
+        if (!telemetry::start(telemetry_out, telemetry_period)) std::exit(-1);
+        auto pages = play.page_count();
+        telemetry::record_occupancy(pages.first, pages.second);
+    }
+
+    if (eval) {
+        // evaluation only, the weights are frozen and shared by the workers
+        evaluate(stat, play, evil, threads, numa, lanes);
+    } else if (actors) {
+        // self-play by the actors, while this thread learns
+        train_async(stat, play, evil, actors, publish);
+    }
+
     while (!stat.is_finished()) {
-        play.open_episode("~:" + evil.name());
-        evil.open_episode(play.name() + ":~");
-        stat.open_episode(play.name() + ":" + evil.name());
+        {
+            profiler::scope prof(profiler::bookkeeping);
+            play.open_episode("~:" + evil.name());
+            evil.open_episode(play.name() + ":~");
+            stat.open_episode(play.name() + ":" + evil.name());
+        }
         episode& game = stat.back();
         while (true) {
             agent& who = game.take_turns(play, evil);
             action move = who.take_action(game.state());
+            profiler::scope prof(profiler::board_op);
             if (game.apply_action(move) != true) break;
             if (who.check_for_win(game.state())) break;
         }
         agent& win = game.last_turns(play, evil);
         play.training();
+        profiler::scope prof(profiler::bookkeeping);
         stat.close_episode(win.name());
         play.close_episode(win.name());
         evil.close_episode(win.name());
+        if (telemetry::wants_occupancy()) {
+            auto pages = play.page_count();
+            telemetry::record_occupancy(pages.first, pages.second);
+        }
     }
 
     if (summary) {
         stat.summary();
     }
+    std::cout << play.name() << " weights: " << play.occupancy() << std::endl;
+    std::cout << evil.name() << " weights: " << evil.occupancy() << std::endl;
+    profiler::report(std::cout);
+    telemetry::stop();
 
     if (save.size()) {
+        profiler::scope prof(profiler::io);
         std::ofstream out(save, std::ios::out | std::ios::trunc);
         out << stat;
         out.close();
@@ -0,0 +1,74 @@
+#pragma once
+#include <string>
+#ifdef WITH_NUMA
+#include <numa.h>
+#endif
+
+/**
+ * NUMA placement of the weight tables
+ *
+ * local:      the default first-touch placement, i.e., the node of the thread which allocates the pages
+ * interleave: the pages are spread round-robin over all the nodes, set before the tables are allocated
+ * replicate:  each node keeps its own read-only copy of the tables, and each worker thread is pinned
+ *             to a node and reads the copy of its node (evaluation only)
+ *
+ * libnuma is optional (build with 'make NUMA=1'); without it, or on a single-node machine,
+ * there is only one node and all the policies fall back to the local placement
+ */
+class topology {
+public:
+    enum policy { local, interleave, replicate };
+
+    static policy parse(const std::string& name) {
+        if (name == "interleave") return interleave;
+        if (name == "replicate") return replicate;
+        return local;
+    }
+    static const char* name(policy p) {
+        const char* names[] = { "local", "interleave", "replicate" };
+        return names[p];
+    }
+
+    /**
+     * the number of memory nodes, 1 if NUMA is unavailable
+     */
+    static int nodes() {
+#ifdef WITH_NUMA
+        if (numa_available() >= 0) return numa_num_configured_nodes();
+#endif
+        return 1;
+    }
+
+    /**
+     * interleave the later allocations of the calling thread (and of the threads it creates) over all the nodes
+     */
+    static void interleave_all() {
+#ifdef WITH_NUMA
+        if (nodes() > 1) numa_set_interleave_mask(numa_all_nodes_ptr);
+#endif
+    }
+
+    /**
+     * pin the calling thread to a node, and allocate from the memory of that node
+     */
+    static void run_on(int node) {
+#ifdef WITH_NUMA
+        if (nodes() > 1) {
+            numa_run_on_node(node);
+            numa_set_preferred(node);
+        }
+#endif
+    }
+
+    /**
+     * release the pinning of the calling thread, and restore the local allocation
+     */
+    static void run_anywhere() {
+#ifdef WITH_NUMA
+        if (nodes() > 1) {
+            numa_run_on_node(-1);
+            numa_set_localalloc();
+        }
+#endif
+    }
+};
@@ -11,36 +11,144 @@
 #include <iostream>
 #include <vector>
 #include <utility>
+#include <algorithm>
+#include <cstdint>
 
+/**
+ * sparse weight table with a two-level page directory
+ *
+ * the directory consists of blocks of 'block_size' pages, each page holds 'page_size' entries;
+ * untouched blocks and pages point to a shared zero block and zero page, so reading needs no branch,
+ * and a page is allocated only when an entry of it is accessed for writing
+ *
+ * a table has a single writer, but may be read by other threads meanwhile: a new block or page is filled
+ * before its pointer is published (release), and the readers load the pointers with acquire
+ *
+ * the stream format is the dense one, i.e., size (uint64) followed by all the values (float)
+ */
 class weight {
 public:
-    weight() {}
-    weight(size_t len) : value(len) {}
-    weight(weight&& f) : value(std::move(f.value)) {}
-    weight(const weight& f) = default;
+    /**
+     * the number of entries per page, the unit of allocation and dirty tracking
+     */
+    static constexpr size_t page_bits = 10;
+    static constexpr size_t page_size = size_t(1) << page_bits;
+    static constexpr size_t block_bits = 7;
+    static constexpr size_t block_size = size_t(1) << block_bits;
+
+public:
+    weight() : length(0) {}
+    weight(size_t len) : length(len), dir(num_blocks(len), zero_block()), dirty(num_pages(len)) {}
+    weight(weight&& f) noexcept : length(f.length), dir(std::move(f.dir)), dirty(std::move(f.dirty)) { f.length = 0; f.dir.clear(); }
+    weight(const weight& f) : weight(f.length) {
+        for (size_t p = 0; p < pages(); p++)
+            if (f.is_materialized(p)) std::copy_n(f.page(p), page_size, materialize(p));
+        dirty = f.dirty;
+    }
+    ~weight() { release(); }
+
+    weight& operator =(const weight& f) { if (this != &f) { weight w(f); swap(w); } return *this; }
+    weight& operator =(weight&& f) noexcept { swap(f); return *this; }
+    float& operator[] (size_t i) { dirty[i >> page_bits] = 1; return materialize(i >> page_bits)[i & (page_size - 1)]; }
+    const float& operator[] (size_t i) const { return published(published(dir[i >> (page_bits + block_bits)])[(i >> page_bits) & (block_size - 1)])[i & (page_size - 1)]; }
+    size_t size() const { return length; }
+
+    void swap(weight& w) noexcept {
+        std::swap(length, w.length);
+        dir.swap(w.dir);
+        dirty.swap(w.dirty);
+    }
+
+public:
+    /**
+     * dirty tracking, any non-const access to an entry marks its page as dirty
+     */
+    size_t pages() const { return dirty.size(); }
+    size_t page_length(size_t p) const { return std::min(page_size, length - p * page_size); }
+    float* page(size_t p) { return materialize(p); }
+    const float* page(size_t p) const { return published(published(dir[p >> block_bits])[p & (block_size - 1)]); }
+    bool is_dirty(size_t p) const { return dirty[p]; }
+    void mark_dirty(size_t p) { dirty[p] = 1; }
+    void mark_clean() { std::fill(dirty.begin(), dirty.end(), 0); }
+    std::vector<uint8_t> dirty_pages() const { return dirty; }
 
-    weight& operator =(const weight& f) = default;
-    float& operator[] (size_t i) { return value[i]; }
-    const float& operator[] (size_t i) const { return value[i]; }
-    size_t size() const { return value.size(); }
+    /**
+     * occupancy, the number of pages which have been allocated
+     */
+    bool is_materialized(size_t p) const { return page(p) != zero_page(); }
+    size_t materialized() const {
+        size_t n = 0;
+        for (size_t p = 0; p < pages(); p++) n += is_materialized(p);
+        return n;
+    }
 
 public:
     friend std::ostream& operator <<(std::ostream& out, const weight& w) {
-        auto& value = w.value;
-        uint64_t size = value.size();
+        uint64_t size = w.size();
         out.write(reinterpret_cast<const char*>(&size), sizeof(uint64_t));
-        out.write(reinterpret_cast<const char*>(value.data()), sizeof(float) * size);
+        for (size_t p = 0; p < w.pages(); p++)
+            out.write(reinterpret_cast<const char*>(w.page(p)), sizeof(float) * w.page_length(p));
         return out;
     }
     friend std::istream& operator >>(std::istream& in, weight& w) {
-        auto& value = w.value;
         uint64_t size = 0;
-        in.read(reinterpret_cast<char*>(&size), sizeof(uint64_t));
-        value.resize(size);
-        in.read(reinterpret_cast<char*>(value.data()), sizeof(float) * size);
+        if (!in.read(reinterpret_cast<char*>(&size), sizeof(uint64_t))) return in;
+        weight(size).swap(w);
+        float buf[page_size];
+        for (size_t p = 0; p < w.pages(); p++) {
+            size_t len = w.page_length(p);
+            if (!in.read(reinterpret_cast<char*>(buf), sizeof(float) * len)) break; // a partial page is not copied
+            if (std::any_of(buf, buf + len, [](float v) { return v != 0; }))
+                std::copy_n(buf, len, w.materialize(p));
+        }
         return in;
     }
 
 protected:
-    std::vector<float> value;
+    static size_t num_pages(size_t len) { return (len + page_size - 1) >> page_bits; }
+    static size_t num_blocks(size_t len) { return (num_pages(len) + block_size - 1) >> block_bits; }
+
+    static float* zero_page() {
+        static float page[page_size] = {};
+        return page;
+    }
+    static float** zero_block() {
+        static struct block { float* page[block_size]; block() { std::fill_n(page, block_size, zero_page()); } } zero;
+        return zero.page;
+    }
+
+    template<typename ptr_t>
+    static ptr_t published(const ptr_t& slot) { return __atomic_load_n(&slot, __ATOMIC_ACQUIRE); }
+    template<typename ptr_t>
+    static void publish(ptr_t& slot, ptr_t ptr) { __atomic_store_n(&slot, ptr, __ATOMIC_RELEASE); }
+
+    float* materialize(size_t p) {
+        float** block = dir[p >> block_bits];
+        if (block == zero_block()) {
+            block = new float*[block_size];
+            std::copy_n(zero_block(), block_size, block);
+            publish(dir[p >> block_bits], block);
+        }
+        float* page = block[p & (block_size - 1)];
+        if (page == zero_page()) {
+            page = new float[page_size]();
+            publish(block[p & (block_size - 1)], page);
+        }
+        return page;
+    }
+
+    void release() {
+        for (float** block : dir) {
+            if (block == zero_block()) continue;
+            for (size_t i = 0; i < block_size; i++)
+                if (block[i] != zero_page()) delete[] block[i];
+            delete[] block;
+        }
+        dir.clear();
+    }
+
+protected:
+    size_t length;
+    std::vector<float**> dir;
+    std::vector<uint8_t> dirty;
 };